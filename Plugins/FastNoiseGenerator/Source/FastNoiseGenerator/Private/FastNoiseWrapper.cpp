@@ -1,5 +1,23 @@
 // Copyright 2021 VICTOR HERNANDEZ MOLPECERES (Rockam). All rights reserved.
 
 #include "FastNoiseWrapper.h"
+#include "Async/ParallelFor.h"
 
-// Nothing to do here
+void UFastNoiseWrapper::GetNoise2DGridParallel(const double originX, const double originY, const double step, const int32 countX, const int32 countY, float* out, const int32 minRowsPerTask) const
+{
+	const int32 rowsPerTask = FMath::Max(1, minRowsPerTask);
+	if (!IsInitialized() || countX <= 0 || countY <= rowsPerTask)
+	{
+		GetNoise2DGrid(originX, originY, step, countX, countY, out);
+		return;
+	}
+
+	// Each task writes a disjoint band of rows, FastNoise is read only while sampling
+	const int32 taskCount = FMath::DivideAndRoundUp(countY, rowsPerTask);
+	ParallelFor(taskCount, [this, originX, originY, step, countX, countY, out, rowsPerTask](const int32 taskIndex)
+	{
+		const int32 rowBegin = taskIndex * rowsPerTask;
+		const int32 rowEnd = FMath::Min(rowBegin + rowsPerTask, countY);
+		fastNoise.GetNoise2DGridRows(originX, originY, step, countX, rowBegin, rowEnd, out);
+	});
+}
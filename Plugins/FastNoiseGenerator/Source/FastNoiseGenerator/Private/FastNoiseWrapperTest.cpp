@@ -0,0 +1,63 @@
+// Copyright 2021 VICTOR HERNANDEZ MOLPECERES (Rockam). All rights reserved.
+
+#include "FastNoiseWrapper.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FFastNoiseGridParallelTest, "FastNoiseGenerator.GetNoise2DGridParallel",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FFastNoiseGridParallelTest::RunTest(const FString& Parameters)
+{
+	// Odd width exercises the SIMD tail, negative origin and fractional step exercise the floor paths
+	const double originX = -123.25;
+	const double originY = 87.5;
+	const double step = 3.75;
+	const int32 countX = 37;
+	const int32 countY = 53;
+	const int32 minRowsPerTaskValues[] = { 1, 3, 16, countY + 1 };
+
+	UFastNoiseWrapper* noise = NewObject<UFastNoiseWrapper>();
+	TArray<float> expected;
+	TArray<float> grid;
+	expected.SetNumUninitialized(countX * countY);
+	grid.SetNumUninitialized(countX * countY);
+
+	for (uint8 noiseType = 0; noiseType <= static_cast<uint8>(EFastNoise_NoiseType::CubicFractal); noiseType++)
+	{
+		for (uint8 fractalType = 0; fractalType <= static_cast<uint8>(EFastNoise_FractalType::RigidMulti); fractalType++)
+		{
+			noise->SetupFastNoise(static_cast<EFastNoise_NoiseType>(noiseType), 1337, 0.01f, EFastNoise_Interp::Quintic, static_cast<EFastNoise_FractalType>(fractalType));
+
+			// Reference values come from the per-point API with the same float coordinates the grid uses
+			for (int32 y = 0; y < countY; y++)
+			{
+				for (int32 x = 0; x < countX; x++)
+				{
+					expected[y * countX + x] = noise->GetNoise2D(static_cast<float>(originX + x * step), static_cast<float>(originY + y * step));
+				}
+			}
+
+			for (const int32 minRowsPerTask : minRowsPerTaskValues)
+			{
+				FMemory::Memset(grid.GetData(), 0xFF, grid.Num() * sizeof(float));
+				noise->GetNoise2DGridParallel(originX, originY, step, countX, countY, grid.GetData(), minRowsPerTask);
+
+				for (int32 index = 0; index < grid.Num(); index++)
+				{
+					if (FMemory::Memcmp(&grid[index], &expected[index], sizeof(float)) != 0)
+					{
+						AddError(FString::Printf(TEXT("Noise type %d, fractal type %d, minRowsPerTask %d: sample (%d, %d) is %.9g, GetNoise2D returns %.9g"),
+							noiseType, fractalType, minRowsPerTask, index % countX, index / countX, grid[index], expected[index]));
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	return !HasAnyErrors();
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
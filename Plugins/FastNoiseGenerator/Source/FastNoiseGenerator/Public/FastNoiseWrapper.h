@@ -83,6 +83,38 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "Fast Noise")
 	float GetNoise2D(const float x, const float y) const { return IsInitialized() ? fastNoise.GetNoise(x, y) : 0.0f; }
 
+	/**
+	* Fills a countX * countY lattice in one pass, out[y * countX + x] = GetNoise2D(originX + x * step, originY + y * step)
+	* The noise type is resolved once for the whole lattice, results match GetNoise2D exactly
+	*
+	* @param originX	- The x axis value of the first sample
+	* @param originY	- The y axis value of the first sample
+	* @param step		- The distance between two samples
+	* @param countX		- The number of samples along x
+	* @param countY		- The number of samples along y
+	* @param out		- countX * countY values, row major
+	*/
+	void GetNoise2DGrid(const double originX, const double originY, const double step, const int32 countX, const int32 countY, float* out) const
+	{
+		if (countX <= 0 || countY <= 0) { return; }
+		if (IsInitialized()) { fastNoise.GetNoise2DGrid(originX, originY, step, countX, countY, out); }
+		else { FMemory::Memzero(out, sizeof(float) * countX * countY); }
+	}
+
+	/**
+	* Same as GetNoise2DGrid, rows are split into bands of at least minRowsPerTask and filled with ParallelFor
+	* Every sample is computed from its absolute row and column, output is bit-identical to GetNoise2DGrid for any thread count
+	*
+	* @param originX		- The x axis value of the first sample
+	* @param originY		- The y axis value of the first sample
+	* @param step			- The distance between two samples
+	* @param countX			- The number of samples along x
+	* @param countY			- The number of samples along y
+	* @param out			- countX * countY values, row major
+	* @param minRowsPerTask	- Minimum rows per worker task, small grids run on the calling thread
+	*/
+	void GetNoise2DGridParallel(const double originX, const double originY, const double step, const int32 countX, const int32 countY, float* out, const int32 minRowsPerTask = 16) const;
+
 	/**
 	* Returns the noise calculation given x, y and z values
 	*
@@ -34,6 +34,14 @@
 #include <algorithm>
 #include <random>
 
+// SSE2 lanes for GetNoise2DGrid, every x64 target has SSE2
+#if !defined(FN_USE_DOUBLES) && (defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define FN_GRID_SSE2 1
+#include <emmintrin.h>
+#else
+#define FN_GRID_SSE2 0
+#endif
+
 const FN_DECIMAL GRAD_X[] =
 {
 	1, -1, 1, -1,
@@ -2248,3 +2256,300 @@ void FastNoise::SingleGradientPerturb(unsigned char offset, FN_DECIMAL warpAmp,
 	x += Lerp(lx0x, lx1x, ys) * warpAmp;
 	y += Lerp(ly0x, ly1x, ys) * warpAmp;
 }
+
+// Grid sampling
+// The noise/fractal type is resolved once, then a single tight loop runs over the whole grid.
+// Coordinates are computed in double from the absolute row/column index and rounded once, exactly
+// as a caller passing FN_DECIMAL(originX + ix * step) to GetNoise would, so both paths produce the
+// same value and a grid split into row ranges matches the same grid filled in one call.
+template <typename Func>
+static void FillGrid2D(double originX, double originY, double step, int countX, int rowBegin, int rowEnd, FN_DECIMAL frequency, FN_DECIMAL* out, Func func)
+{
+	out += rowBegin * countX;
+
+	for (int iy = rowBegin; iy < rowEnd; iy++)
+	{
+		FN_DECIMAL y = FN_DECIMAL(originY + iy * step) * frequency;
+
+		for (int ix = 0; ix < countX; ix++)
+		{
+			*out++ = func(FN_DECIMAL(originX + ix * step) * frequency, y);
+		}
+	}
+}
+
+#if FN_GRID_SSE2
+// Lane-wise FastFloor, (int)f truncates and negative values subtract one
+static inline __m128i FastFloorSSE(__m128 f)
+{
+	return _mm_add_epi32(_mm_cvttps_epi32(f), _mm_castps_si128(_mm_cmplt_ps(f, _mm_setzero_ps())));
+}
+
+static inline __m128 FastAbsSSE(__m128 f)
+{
+	return _mm_andnot_ps(_mm_set1_ps(-0.0f), f);
+}
+
+// One simplex corner for 4 lanes. Table lookups stay scalar, the arithmetic keeps
+// the operation order of SingleSimplex so every lane matches the scalar result bit for bit.
+static inline __m128 SimplexCornerSSE(const unsigned char* perm, const unsigned char* perm12, unsigned char offset, __m128i i, __m128i j, __m128 xd, __m128 yd)
+{
+	__m128 t = _mm_sub_ps(_mm_sub_ps(_mm_set1_ps(FN_DECIMAL(0.5)), _mm_mul_ps(xd, xd)), _mm_mul_ps(yd, yd));
+	__m128 inside = _mm_cmpge_ps(t, _mm_setzero_ps());
+
+	if (_mm_movemask_ps(inside) == 0)
+		return _mm_setzero_ps();
+
+	alignas(16) int ia[4];
+	alignas(16) int ja[4];
+	alignas(16) FN_DECIMAL gx[4];
+	alignas(16) FN_DECIMAL gy[4];
+	_mm_store_si128((__m128i*)ia, i);
+	_mm_store_si128((__m128i*)ja, j);
+
+	for (int lane = 0; lane < 4; lane++)
+	{
+		unsigned char lutPos = perm12[(ia[lane] & 0xff) + perm[(ja[lane] & 0xff) + offset]];
+		gx[lane] = GRAD_X[lutPos];
+		gy[lane] = GRAD_Y[lutPos];
+	}
+
+	__m128 grad = _mm_add_ps(_mm_mul_ps(xd, _mm_load_ps(gx)), _mm_mul_ps(yd, _mm_load_ps(gy)));
+
+	t = _mm_mul_ps(t, t);
+	return _mm_and_ps(inside, _mm_mul_ps(_mm_mul_ps(t, t), grad));
+}
+
+static inline __m128 SingleSimplexSSE(const unsigned char* perm, const unsigned char* perm12, unsigned char offset, __m128 x, __m128 y)
+{
+	const __m128 g2 = _mm_set1_ps(G2);
+	const __m128i one = _mm_set1_epi32(1);
+
+	__m128 t = _mm_mul_ps(_mm_add_ps(x, y), _mm_set1_ps(F2));
+	__m128i i = FastFloorSSE(_mm_add_ps(x, t));
+	__m128i j = FastFloorSSE(_mm_add_ps(y, t));
+
+	t = _mm_mul_ps(_mm_cvtepi32_ps(_mm_add_epi32(i, j)), g2);
+	__m128 x0 = _mm_sub_ps(x, _mm_sub_ps(_mm_cvtepi32_ps(i), t));
+	__m128 y0 = _mm_sub_ps(y, _mm_sub_ps(_mm_cvtepi32_ps(j), t));
+
+	__m128i upper = _mm_castps_si128(_mm_cmpgt_ps(x0, y0));
+	__m128i i1 = _mm_and_si128(upper, one);
+	__m128i j1 = _mm_andnot_si128(upper, one);
+
+	__m128 x1 = _mm_add_ps(_mm_sub_ps(x0, _mm_cvtepi32_ps(i1)), g2);
+	__m128 y1 = _mm_add_ps(_mm_sub_ps(y0, _mm_cvtepi32_ps(j1)), g2);
+	__m128 x2 = _mm_add_ps(_mm_sub_ps(x0, _mm_set1_ps(1)), _mm_set1_ps(2 * G2));
+	__m128 y2 = _mm_add_ps(_mm_sub_ps(y0, _mm_set1_ps(1)), _mm_set1_ps(2 * G2));
+
+	__m128 n0 = SimplexCornerSSE(perm, perm12, offset, i, j, x0, y0);
+	__m128 n1 = SimplexCornerSSE(perm, perm12, offset, _mm_add_epi32(i, i1), _mm_add_epi32(j, j1), x1, y1);
+	__m128 n2 = SimplexCornerSSE(perm, perm12, offset, _mm_add_epi32(i, one), _mm_add_epi32(j, one), x2, y2);
+
+	return _mm_mul_ps(_mm_set1_ps(70), _mm_add_ps(_mm_add_ps(n0, n1), n2));
+}
+
+// 4 points per step along each row, the last block repeats the final column and only writes valid lanes
+template <typename Func>
+static void FillGrid2DSSE(double originX, double originY, double step, int countX, int rowBegin, int rowEnd, FN_DECIMAL frequency, FN_DECIMAL* out, Func func)
+{
+	const __m128 freq = _mm_set1_ps(frequency);
+
+	out += rowBegin * countX;
+
+	for (int iy = rowBegin; iy < rowEnd; iy++)
+	{
+		__m128 y = _mm_mul_ps(_mm_set1_ps(FN_DECIMAL(originY + iy * step)), freq);
+
+		for (int ix = 0; ix < countX; ix += 4)
+		{
+			alignas(16) FN_DECIMAL lanes[4];
+			for (int lane = 0; lane < 4; lane++)
+				lanes[lane] = FN_DECIMAL(originX + std::min(ix + lane, countX - 1) * step);
+
+			_mm_store_ps(lanes, func(_mm_mul_ps(_mm_load_ps(lanes), freq), y));
+
+			int valid = std::min(4, countX - ix);
+			for (int lane = 0; lane < valid; lane++)
+				*out++ = lanes[lane];
+		}
+	}
+}
+#endif
+
+void FastNoise::GetNoise2DGrid(double originX, double originY, double step, int countX, int countY, FN_DECIMAL* out) const
+{
+	GetNoise2DGridRows(originX, originY, step, countX, 0, countY, out);
+}
+
+void FastNoise::GetNoise2DGridRows(double originX, double originY, double step, int countX, int rowBegin, int rowEnd, FN_DECIMAL* out) const
+{
+	if (countX <= 0 || rowBegin >= rowEnd)
+		return;
+
+	switch (m_noiseType)
+	{
+	case Value:
+		FillGrid2D(originX, originY, step, countX, rowBegin, rowEnd, m_frequency, out, [this](FN_DECIMAL x, FN_DECIMAL y) { return SingleValue(0, x, y); });
+		return;
+	case ValueFractal:
+		switch (m_fractalType)
+		{
+		case FBM:
+			FillGrid2D(originX, originY, step, countX, rowBegin, rowEnd, m_frequency, out, [this](FN_DECIMAL x, FN_DECIMAL y) { return SingleValueFractalFBM(x, y); });
+			return;
+		case Billow:
+			FillGrid2D(originX, originY, step, countX, rowBegin, rowEnd, m_frequency, out, [this](FN_DECIMAL x, FN_DECIMAL y) { return SingleValueFractalBillow(x, y); });
+			return;
+		case RigidMulti:
+			FillGrid2D(originX, originY, step, countX, rowBegin, rowEnd, m_frequency, out, [this](FN_DECIMAL x, FN_DECIMAL y) { return SingleValueFractalRigidMulti(x, y); });
+			return;
+		}
+		break;
+	case Perlin:
+		FillGrid2D(originX, originY, step, countX, rowBegin, rowEnd, m_frequency, out, [this](FN_DECIMAL x, FN_DECIMAL y) { return SinglePerlin(0, x, y); });
+		return;
+	case PerlinFractal:
+		switch (m_fractalType)
+		{
+		case FBM:
+			FillGrid2D(originX, originY, step, countX, rowBegin, rowEnd, m_frequency, out, [this](FN_DECIMAL x, FN_DECIMAL y) { return SinglePerlinFractalFBM(x, y); });
+			return;
+		case Billow:
+			FillGrid2D(originX, originY, step, countX, rowBegin, rowEnd, m_frequency, out, [this](FN_DECIMAL x, FN_DECIMAL y) { return SinglePerlinFractalBillow(x, y); });
+			return;
+		case RigidMulti:
+			FillGrid2D(originX, originY, step, countX, rowBegin, rowEnd, m_frequency, out, [this](FN_DECIMAL x, FN_DECIMAL y) { return SinglePerlinFractalRigidMulti(x, y); });
+			return;
+		}
+		break;
+#if FN_GRID_SSE2
+	case Simplex:
+		FillGrid2DSSE(originX, originY, step, countX, rowBegin, rowEnd, m_frequency, out, [this](__m128 x, __m128 y) { return SingleSimplexSSE(m_perm, m_perm12, 0, x, y); });
+		return;
+	case SimplexFractal:
+		switch (m_fractalType)
+		{
+		case FBM:
+			FillGrid2DSSE(originX, originY, step, countX, rowBegin, rowEnd, m_frequency, out, [this](__m128 x, __m128 y)
+			{
+				const __m128 lacunarity = _mm_set1_ps(m_lacunarity);
+				__m128 sum = SingleSimplexSSE(m_perm, m_perm12, m_perm[0], x, y);
+				FN_DECIMAL amp = 1;
+				int i = 0;
+
+				while (++i < m_octaves)
+				{
+					x = _mm_mul_ps(x, lacunarity);
+					y = _mm_mul_ps(y, lacunarity);
+
+					amp *= m_gain;
+					sum = _mm_add_ps(sum, _mm_mul_ps(SingleSimplexSSE(m_perm, m_perm12, m_perm[i], x, y), _mm_set1_ps(amp)));
+				}
+
+				return _mm_mul_ps(sum, _mm_set1_ps(m_fractalBounding));
+			});
+			return;
+		case Billow:
+			FillGrid2DSSE(originX, originY, step, countX, rowBegin, rowEnd, m_frequency, out, [this](__m128 x, __m128 y)
+			{
+				const __m128 lacunarity = _mm_set1_ps(m_lacunarity);
+				const __m128 two = _mm_set1_ps(2);
+				const __m128 one = _mm_set1_ps(1);
+				__m128 sum = _mm_sub_ps(_mm_mul_ps(FastAbsSSE(SingleSimplexSSE(m_perm, m_perm12, m_perm[0], x, y)), two), one);
+				FN_DECIMAL amp = 1;
+				int i = 0;
+
+				while (++i < m_octaves)
+				{
+					x = _mm_mul_ps(x, lacunarity);
+					y = _mm_mul_ps(y, lacunarity);
+
+					amp *= m_gain;
+					__m128 n = _mm_sub_ps(_mm_mul_ps(FastAbsSSE(SingleSimplexSSE(m_perm, m_perm12, m_perm[i], x, y)), two), one);
+					sum = _mm_add_ps(sum, _mm_mul_ps(n, _mm_set1_ps(amp)));
+				}
+
+				return _mm_mul_ps(sum, _mm_set1_ps(m_fractalBounding));
+			});
+			return;
+		case RigidMulti:
+			FillGrid2DSSE(originX, originY, step, countX, rowBegin, rowEnd, m_frequency, out, [this](__m128 x, __m128 y)
+			{
+				const __m128 lacunarity = _mm_set1_ps(m_lacunarity);
+				const __m128 one = _mm_set1_ps(1);
+				__m128 sum = _mm_sub_ps(one, FastAbsSSE(SingleSimplexSSE(m_perm, m_perm12, m_perm[0], x, y)));
+				FN_DECIMAL amp = 1;
+				int i = 0;
+
+				while (++i < m_octaves)
+				{
+					x = _mm_mul_ps(x, lacunarity);
+					y = _mm_mul_ps(y, lacunarity);
+
+					amp *= m_gain;
+					__m128 n = _mm_sub_ps(one, FastAbsSSE(SingleSimplexSSE(m_perm, m_perm12, m_perm[i], x, y)));
+					sum = _mm_sub_ps(sum, _mm_mul_ps(n, _mm_set1_ps(amp)));
+				}
+
+				return sum;
+			});
+			return;
+		}
+		break;
+#else
+	case Simplex:
+		FillGrid2D(originX, originY, step, countX, rowBegin, rowEnd, m_frequency, out, [this](FN_DECIMAL x, FN_DECIMAL y) { return SingleSimplex(0, x, y); });
+		return;
+	case SimplexFractal:
+		switch (m_fractalType)
+		{
+		case FBM:
+			FillGrid2D(originX, originY, step, countX, rowBegin, rowEnd, m_frequency, out, [this](FN_DECIMAL x, FN_DECIMAL y) { return SingleSimplexFractalFBM(x, y); });
+			return;
+		case Billow:
+			FillGrid2D(originX, originY, step, countX, rowBegin, rowEnd, m_frequency, out, [this](FN_DECIMAL x, FN_DECIMAL y) { return SingleSimplexFractalBillow(x, y); });
+			return;
+		case RigidMulti:
+			FillGrid2D(originX, originY, step, countX, rowBegin, rowEnd, m_frequency, out, [this](FN_DECIMAL x, FN_DECIMAL y) { return SingleSimplexFractalRigidMulti(x, y); });
+			return;
+		}
+		break;
+#endif
+	case Cellular:
+		switch (m_cellularReturnType)
+		{
+		case CellValue:
+		case NoiseLookup:
+		case Distance:
+			FillGrid2D(originX, originY, step, countX, rowBegin, rowEnd, m_frequency, out, [this](FN_DECIMAL x, FN_DECIMAL y) { return SingleCellular(x, y); });
+			return;
+		default:
+			FillGrid2D(originX, originY, step, countX, rowBegin, rowEnd, m_frequency, out, [this](FN_DECIMAL x, FN_DECIMAL y) { return SingleCellular2Edge(x, y); });
+			return;
+		}
+	case WhiteNoise:
+		FillGrid2D(originX, originY, step, countX, rowBegin, rowEnd, m_frequency, out, [this](FN_DECIMAL x, FN_DECIMAL y) { return GetWhiteNoise(x, y); });
+		return;
+	case Cubic:
+		FillGrid2D(originX, originY, step, countX, rowBegin, rowEnd, m_frequency, out, [this](FN_DECIMAL x, FN_DECIMAL y) { return SingleCubic(0, x, y); });
+		return;
+	case CubicFractal:
+		switch (m_fractalType)
+		{
+		case FBM:
+			FillGrid2D(originX, originY, step, countX, rowBegin, rowEnd, m_frequency, out, [this](FN_DECIMAL x, FN_DECIMAL y) { return SingleCubicFractalFBM(x, y); });
+			return;
+		case Billow:
+			FillGrid2D(originX, originY, step, countX, rowBegin, rowEnd, m_frequency, out, [this](FN_DECIMAL x, FN_DECIMAL y) { return SingleCubicFractalBillow(x, y); });
+			return;
+		case RigidMulti:
+			FillGrid2D(originX, originY, step, countX, rowBegin, rowEnd, m_frequency, out, [this](FN_DECIMAL x, FN_DECIMAL y) { return SingleCubicFractalRigidMulti(x, y); });
+			return;
+		}
+		break;
+	}
+
+	// Anything GetNoise resolves by falling through its switch
+	FillGrid2D(originX, originY, step, countX, rowBegin, rowEnd, 1, out, [this](FN_DECIMAL x, FN_DECIMAL y) { return GetNoise(x, y); });
+}
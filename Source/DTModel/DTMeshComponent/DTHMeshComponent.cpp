@@ -3,16 +3,64 @@
 
 #include "DTHMeshComponent.h"
 #include "Materials/MaterialRenderProxy.h"
+#include "Async/ParallelFor.h"
 #include "PhysicsEngine/BodySetup.h"
 #include "PhysicsEngine/PhysicsSettings.h"
 
 UE_DISABLE_OPTIMIZATION_SHIP
 
 // --------------------------------------------------------------------------
-// 模型代理 构造函数
+// 模型缓冲 析构函数
+FDTHMeshData::~FDTHMeshData()
+{
+	PositionVertexBuffer.ReleaseResource();
+	StaticMeshVertexBuffer.ReleaseResource();
+	ColorVertexBuffer.ReleaseResource();
+	IndexBuffer.ReleaseResource();
+}
+
+// 创建共享数据, 删除放到渲染线程, 不会和使用中的渲染资源冲突
+FDTHMeshDataPtr FDTHMeshData::Create(bool bInKeepCPUData)
+{
+	FDTHMeshDataPtr MeshData(new FDTHMeshData(), [](FDTHMeshData * MeshData)
+	{
+		ENQUEUE_RENDER_COMMAND(DeleteDTHMeshData)([MeshData](FRHICommandListImmediate& RHICmdList)
+		{
+			delete MeshData;
+		});
+	});
+	MeshData->bKeepCPUData = bInKeepCPUData;
+	return MeshData;
+}
+
+// 上传到GPU
+void FDTHMeshData::InitResources(FRHICommandListBase& RHICmdList)
+{
+	check(IsInRenderingThread());
+	if ( bInitialized )
+	{
+		return;
+	}
+	bInitialized = true;
+
+	// 顶点缓冲初始化时设置了不需要CPU访问, 上传后自动释放
+	StaticMeshVertexBuffer.InitResource(RHICmdList);
+	PositionVertexBuffer.InitResource(RHICmdList);
+	ColorVertexBuffer.InitResource(RHICmdList);
+	IndexBuffer.InitResource(RHICmdList);
+
+	// 索引缓冲上传时复制, 这里释放
+	if ( !bKeepCPUData )
+	{
+		IndexBuffer.Indices.Empty();
+	}
+}
+
+// --------------------------------------------------------------------------
+// 模型代理 构造函数, 只引用组件的模型缓冲
 FDTHMeshSceneProxy::FDTHMeshSceneProxy(UDTHMeshComponent* DTMeshComponent)
 	: FPrimitiveSceneProxy(DTMeshComponent)
-	, m_bHaveMesh(DTMeshComponent->GetMeshData().StaticMeshVertexBuffer.GetNumVertices() != 0)
+	, m_bHaveMesh(DTMeshComponent->GetMeshData().IsValid() && DTMeshComponent->GetMeshData()->NumVertices != 0)
 	, m_MeshData(DTMeshComponent->GetMeshData())
 	, m_MaterialInterface(DTMeshComponent->GetMaterial(0) ? DTMeshComponent->GetMaterial(0) : UMaterial::GetDefaultMaterial(MD_Surface))
 	, m_VertexFactory(GetScene().GetFeatureLevel(), "DTHMeshSceneProxy")
@@ -23,6 +71,7 @@ FDTHMeshSceneProxy::FDTHMeshSceneProxy(UDTHMeshComponent* DTMeshComponent)
 
 FDTHMeshSceneProxy::~FDTHMeshSceneProxy()
 {
+	m_MeshData.Reset();
 }
 
 // 返回Hash值
@@ -72,33 +121,47 @@ void FDTHMeshSceneProxy::CreateRenderThreadResources()
 	FRHICommandListBase& RHICmdList = FRHICommandListImmediate::Get();
 #endif
 
+	BindMeshData(RHICmdList);
+}
+
+// 替换模型缓冲
+void FDTHMeshSceneProxy::SetMeshData_RenderThread(FRHICommandListBase& RHICmdList, const FDTHMeshDataPtr& MeshData)
+{
+	check(IsInRenderingThread());
+	if ( m_VertexFactory.IsInitialized() )
+	{
+		m_VertexFactory.ReleaseResource();
+	}
+
+	// 旧缓冲的最后一个引用在这里释放
+	m_MeshData = MeshData;
+	m_bHaveMesh = m_MeshData.IsValid() && m_MeshData->NumVertices != 0;
+	BindMeshData(RHICmdList);
+}
+
+// 上传模型缓冲并绑定顶点工厂
+void FDTHMeshSceneProxy::BindMeshData(FRHICommandListBase& RHICmdList)
+{
 	if ( m_bHaveMesh )
 	{
-		m_MeshData.StaticMeshVertexBuffer.InitResource(RHICmdList);
-		m_MeshData.PositionVertexBuffer.InitResource(RHICmdList);
-		m_MeshData.ColorVertexBuffer.InitResource(RHICmdList);
-		m_MeshData.IndexBuffer.InitResource(RHICmdList);
+		m_MeshData->InitResources(RHICmdList);
 
 		FLocalVertexFactory::FDataType Data;
-		m_MeshData.PositionVertexBuffer.BindPositionVertexBuffer(&m_VertexFactory, Data);
-		m_MeshData.StaticMeshVertexBuffer.BindTangentVertexBuffer(&m_VertexFactory, Data);
-		m_MeshData.StaticMeshVertexBuffer.BindPackedTexCoordVertexBuffer(&m_VertexFactory, Data);
-		m_MeshData.StaticMeshVertexBuffer.BindLightMapVertexBuffer(&m_VertexFactory, Data, 0);
-		m_MeshData.ColorVertexBuffer.BindColorVertexBuffer(&m_VertexFactory, Data);
+		m_MeshData->PositionVertexBuffer.BindPositionVertexBuffer(&m_VertexFactory, Data);
+		m_MeshData->StaticMeshVertexBuffer.BindTangentVertexBuffer(&m_VertexFactory, Data);
+		m_MeshData->StaticMeshVertexBuffer.BindPackedTexCoordVertexBuffer(&m_VertexFactory, Data);
+		m_MeshData->StaticMeshVertexBuffer.BindLightMapVertexBuffer(&m_VertexFactory, Data, 0);
+		m_MeshData->ColorVertexBuffer.BindColorVertexBuffer(&m_VertexFactory, Data);
 		m_VertexFactory.SetData(RHICmdList, Data);
 		m_VertexFactory.InitResource(RHICmdList);
 	}
 }
 
-// 绘画线程销毁
+// 绘画线程销毁, 模型缓冲由最后一个引用释放
 void FDTHMeshSceneProxy::DestroyRenderThreadResources()
 {
-	if ( m_bHaveMesh )
+	if ( m_VertexFactory.IsInitialized() )
 	{
-		m_MeshData.PositionVertexBuffer.ReleaseResource();
-		m_MeshData.StaticMeshVertexBuffer.ReleaseResource();
-		m_MeshData.ColorVertexBuffer.ReleaseResource();
-		m_MeshData.IndexBuffer.ReleaseResource();
 		m_VertexFactory.ReleaseResource();
 	}
 }
@@ -153,11 +216,11 @@ void FDTHMeshSceneProxy::GetDynamicMeshElements(const TArray<const FSceneView*>&
 			DynamicPrimitiveUniformBuffer.Set(Collector.GetRHICommandList(), GetLocalToWorld(), PreviousLocalToWorld, GetBounds(), GetLocalBounds(), GetLocalBounds(), ReceivesDecals(), bHasPrecomputedVolumetricLightmap, bOutputVelocity, GetCustomPrimitiveData());
 			BatchElement.PrimitiveUniformBufferResource = &DynamicPrimitiveUniformBuffer.UniformBuffer;
 			
-			BatchElement.IndexBuffer = &m_MeshData.IndexBuffer;
+			BatchElement.IndexBuffer = &m_MeshData->IndexBuffer;
 			BatchElement.FirstIndex = 0;
-			BatchElement.NumPrimitives = m_MeshData.IndexBuffer.Indices.Num() / 3;
+			BatchElement.NumPrimitives = m_MeshData->NumIndices / 3;
 			BatchElement.MinVertexIndex = 0;
-			BatchElement.MaxVertexIndex = m_MeshData.PositionVertexBuffer.GetNumVertices() - 1;
+			BatchElement.MaxVertexIndex = m_MeshData->NumVertices - 1;
 
 			Collector.AddMesh(ViewIndex, Mesh);
 		}
@@ -169,6 +232,8 @@ void FDTHMeshSceneProxy::GetDynamicMeshElements(const TArray<const FSceneView*>&
 // 模型组件 构造函数
 UDTHMeshComponent::UDTHMeshComponent(const FObjectInitializer& ObjectInitializer)
 	: Super(ObjectInitializer)
+	, m_bKeepCPUData( false )
+	, m_bCPUDataAvailable( false )
 	, m_MeshSceneProxy( nullptr )
 	, m_LocalBounds( ForceInitToZero )
 {
@@ -190,6 +255,11 @@ void UDTHMeshComponent::TickComponent(float DeltaTime, ELevelTick TickType, FAct
 // 场景代理
 FPrimitiveSceneProxy* UDTHMeshComponent::CreateSceneProxy()
 {
+	// 不保留CPU数据时, 交给场景代理后渲染线程随时会释放
+	if ( m_MeshData.IsValid() && !m_MeshData->bKeepCPUData )
+	{
+		m_bCPUDataAvailable = false;
+	}
 	m_MeshSceneProxy = new FDTHMeshSceneProxy(this);
 	return m_MeshSceneProxy;
 }
@@ -197,15 +267,7 @@ FPrimitiveSceneProxy* UDTHMeshComponent::CreateSceneProxy()
 // 碰撞代理
 UBodySetup* UDTHMeshComponent::GetBodySetup()
 {
-	if ( m_BodySetup == nullptr )
-	{
-		m_BodySetup = NewObject<UBodySetup>(this, NAME_None, (IsTemplate() ? RF_Public | RF_ArchetypeObject : RF_NoFlags));
-		m_BodySetup->BodySetupGuid = FGuid::NewGuid();
-		m_BodySetup->bGenerateMirroredCollision = false;
-		m_BodySetup->bDoubleSidedGeometry = true;
-		m_BodySetup->CollisionTraceFlag = CTF_UseComplexAsSimple;
-	}
-	return m_BodySetup;
+	return m_Collision.GetBodySetup(this);
 }
 
 // 返回场景大小
@@ -226,53 +288,56 @@ int32 UDTHMeshComponent::GetNumMaterials() const
 // 返回 GetPhysicsTriMeshData 的估算量
 bool UDTHMeshComponent::GetTriMeshSizeEstimates(FTriMeshCollisionDataEstimates& OutTriMeshEstimates, bool bInUseAllTriData) const
 {
-	OutTriMeshEstimates.VerticeCount += m_MeshData.StaticMeshVertexBuffer.GetNumVertices();
+	OutTriMeshEstimates.VerticeCount += m_MeshData.IsValid() ? m_MeshData->NumVertices : 0;
 	return true;
 }
 
 // 返回碰撞数据
 bool UDTHMeshComponent::GetPhysicsTriMeshData(FTriMeshCollisionData* CollisionData, bool InUseAllTriData)
 {
-	// // UV碰撞体
-	// bool bCopyUVs = UPhysicsSettings::Get()->bSupportUVFromHitResults; 
-	// if ( bCopyUVs )
-	// {
-	// 	// 先只设置一层UV
-	// 	CollisionData->UVs.AddZeroed(1); 
-	// }
-	//
-	// // 只添加0层LOD
-	// if ( m_MeshData )
-	// {
-	// 	// 获取点数据
-	// 	for (int32 VertIndex = 0; VertIndex < m_MeshData->StaticMeshVertexBuffer.GetNumVertices(); VertIndex++)
-	// 	{
-	// 		CollisionData->Vertices.Add(LODMesh.Vertices[VertIndex].Position);
-	// 		
-	// 		if ( bCopyUVs )
-	// 		{
-	// 			CollisionData->UVs[0].Add(FVector2D(LODMesh.Vertices[VertIndex].TextureCoordinate[0]));
-	// 		}
-	// 	}
-	//
-	// 	// 获取三角形数据
-	// 	for (int32 TriIndex = 0; TriIndex < LODMesh.Triangles.Num(); TriIndex++)
-	// 	{
-	// 		// 保存偏移后三角形
-	// 		FTriIndices Triangle;
-	// 		Triangle.v0 = LODMesh.Triangles[TriIndex].X;
-	// 		Triangle.v1 = LODMesh.Triangles[TriIndex].Y;
-	// 		Triangle.v2 = LODMesh.Triangles[TriIndex].Z;
-	// 		CollisionData->Indices.Add(Triangle);
-	//
-	// 		// 保存材质索引
-	// 		CollisionData->MaterialIndices.Add(0);
-	// 	}
-	// }
-	//
-	// CollisionData->bFlipNormals = true;
-	// CollisionData->bDeformableMesh = true;
-	// CollisionData->bFastCook = true;
+	// 简化模型或规则网格
+	if ( m_Collision.IsProxy() )
+	{
+		m_Collision.ExportProxy(CollisionData);
+		CollisionData->bFlipNormals = true;
+		CollisionData->bDeformableMesh = true;
+		CollisionData->bFastCook = true;
+		return true;
+	}
+
+	// UV碰撞体
+	const bool bCopyUVs = UPhysicsSettings::Get()->bSupportUVFromHitResults;
+
+	// 顶点缓冲还有CPU数据时直接从缓冲复制, 不再保存一份模型
+	if ( !m_bCPUDataAvailable )
+	{
+		return false;
+	}
+	FDTHMeshData & MeshData = *m_MeshData;
+	const int32 NumVertices = MeshData.NumVertices;
+	const int32 NumTriangles = MeshData.NumIndices / 3;
+	if ( NumVertices && NumTriangles )
+	{
+		FDTMeshCollision::AllocateTriMeshData(CollisionData, NumVertices, NumTriangles, bCopyUVs);
+
+		// 获取点数据
+		FDTMeshCollision::CopyVertices(CollisionData, 0, TConstArrayView<FVector3f>(&MeshData.PositionVertexBuffer.VertexPosition(0), NumVertices));
+		if ( bCopyUVs )
+		{
+			ParallelFor(NumVertices, [&](int32 VertIndex)
+			{
+				CollisionData->UVs[0][VertIndex] = FVector2D(MeshData.StaticMeshVertexBuffer.GetVertexUV(VertIndex, 0));
+			});
+		}
+
+		// 获取三角形数据
+		const TConstArrayView<FUintVector> Triangles(reinterpret_cast<const FUintVector*>(MeshData.IndexBuffer.Indices.GetData()), NumTriangles);
+		FDTMeshCollision::CopyTriangles(CollisionData, 0, 0, Triangles, 0);
+	}
+
+	CollisionData->bFlipNormals = true;
+	CollisionData->bDeformableMesh = true;
+	CollisionData->bFastCook = true;
 
 	return true;
 }
@@ -280,25 +345,68 @@ bool UDTHMeshComponent::GetPhysicsTriMeshData(FTriMeshCollisionData* CollisionDa
 // 返回碰撞支持
 bool UDTHMeshComponent::ContainsPhysicsTriMeshData(bool InUseAllTriData) const
 {
-	return !!m_MeshData.StaticMeshVertexBuffer.GetNumVertices();
+	if ( m_Collision.Source == EDTMeshCollisionSource::None || !m_MeshData.IsValid() || !m_MeshData->NumVertices )
+	{
+		return false;
+	}
+	return m_Collision.IsProxy() || m_bCPUDataAvailable;
 }
 
 // 更新碰撞体
 void UDTHMeshComponent::UpdateBodySetup()
 {
-	if ( UBodySetup* BodySetup = GetBodySetup() )
+	// 渲染和简化来源需要CPU数据, 已经只保存在GPU时保留当前碰撞体
+	const bool bNeedCPUData = m_Collision.Source == EDTMeshCollisionSource::Render || m_Collision.Source == EDTMeshCollisionSource::Decimated;
+	if ( bNeedCPUData && !m_bCPUDataAvailable )
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s: mesh data is GPU only, collision needs SetKeepCPUData(true) or a lattice"), *GetName());
+		return;
+	}
+
+	// 简化模型从顶点缓冲生成
+	if ( m_Collision.Source == EDTMeshCollisionSource::Decimated )
+	{
+		m_Collision.ResetProxy();
+		const FDTHMeshData & MeshData = *m_MeshData;
+		if ( MeshData.NumVertices )
+		{
+			const TConstArrayView<FVector3f> Positions(&MeshData.PositionVertexBuffer.VertexPosition(0), MeshData.NumVertices);
+			const TConstArrayView<FUintVector> Triangles(reinterpret_cast<const FUintVector*>(MeshData.IndexBuffer.Indices.GetData()), MeshData.NumIndices / 3);
+			m_Collision.AppendDecimated(Positions, Triangles, 0);
+		}
+	}
+	m_Collision.Cook(this, true);
+}
+
+// 设置碰撞数据来源
+void UDTHMeshComponent::SetCollisionSource(EDTMeshCollisionSource Source, double DecimateSize)
+{
+	if ( m_Collision.Source != Source || m_Collision.DecimateSize != DecimateSize )
 	{
-		BodySetup->bHasCookedCollisionData = true;
-		BodySetup->InvalidatePhysicsData();
-		BodySetup->CreatePhysicsMeshes();
-		RecreatePhysicsState();
+		m_Collision.Source = Source;
+		m_Collision.DecimateSize = DecimateSize;
+		if ( m_MeshData.IsValid() && m_MeshData->NumVertices )
+		{
+			UpdateBodySetup();
+		}
+	}
+}
+
+// 使用规则网格作为碰撞
+void UDTHMeshComponent::SetCollisionLattice(TConstArrayView<FVector> Points, TConstArrayView<int32> Triangles)
+{
+	m_Collision.Source = EDTMeshCollisionSource::Lattice;
+	m_Collision.SetLattice(Points, Triangles);
+	if ( m_MeshData.IsValid() && m_MeshData->NumVertices )
+	{
+		UpdateBodySetup();
 	}
 }
 
 
 
 // 创建模型
-void UDTHMeshComponent::SetMesh(const TArray<FVector>& Vertices, const TArray<int32>& Triangles, const TArray<FVector>& Normals, const TArray<FVector2D>& UVs)
+void UDTHMeshComponent::SetMesh(TConstArrayView<FVector> Vertices, TConstArrayView<int32> Triangles, TConstArrayView<FVector> Normals, TConstArrayView<FVector2D> UVs)
 {
 
 	// 设置点和面
@@ -306,10 +414,18 @@ void UDTHMeshComponent::SetMesh(const TArray<FVector>& Vertices, const TArray<in
 	const bool HaveNormal = Normals.Num() == VertexCount;
 	const bool HaveUV = UVs.Num() == VertexCount;
 	
-	m_MeshData.PositionVertexBuffer.Init(Vertices.Num());
-	m_MeshData.StaticMeshVertexBuffer.Init(Vertices.Num(), 1);
-	m_MeshData.ColorVertexBuffer.Init(Vertices.Num());
-	for (int32 Index = 0; Index < Vertices.Num(); Index++)
+	// 新的缓冲, 旧缓冲由使用中的场景代理释放
+	m_MeshData = FDTHMeshData::Create(m_bKeepCPUData);
+	m_MeshData->NumVertices = VertexCount;
+	m_MeshData->NumIndices = Triangles.Num();
+	m_bCPUDataAvailable = true;
+	
+	// 不保留CPU数据时, 顶点缓冲上传后自动释放
+	FDTHMeshData & MeshData = *m_MeshData;
+	MeshData.PositionVertexBuffer.Init(VertexCount, m_bKeepCPUData);
+	MeshData.StaticMeshVertexBuffer.Init(VertexCount, 1, m_bKeepCPUData);
+	MeshData.ColorVertexBuffer.Init(VertexCount, m_bKeepCPUData);
+	for (int32 Index = 0; Index < VertexCount; Index++)
 	{
 		const FVector& Position = Vertices[Index];
 		const FVector3f TangentX(HaveNormal && HaveUV ? FVector3f::ForwardVector : FVector3f::ForwardVector);
@@ -317,24 +433,63 @@ void UDTHMeshComponent::SetMesh(const TArray<FVector>& Vertices, const TArray<in
 		const FVector3f TangentY(TangentX ^ TangentZ);
 		const FVector2f TexCoord(HaveUV ? FVector2f(UVs[Index]) : FVector2f::ZeroVector);
 		
-		m_MeshData.PositionVertexBuffer.VertexPosition(Index).Set(Position.X, Position.Y, Position.Z);
-		m_MeshData.StaticMeshVertexBuffer.SetVertexTangents(Index, TangentX, TangentY, TangentZ);
-		m_MeshData.StaticMeshVertexBuffer.SetVertexUV(Index, 0, FVector2f(TexCoord.X, TexCoord.Y));
-		m_MeshData.ColorVertexBuffer.VertexColor(Index) = FColor::White;
+		MeshData.PositionVertexBuffer.VertexPosition(Index).Set(Position.X, Position.Y, Position.Z);
+		MeshData.StaticMeshVertexBuffer.SetVertexTangents(Index, TangentX, TangentY, TangentZ);
+		MeshData.StaticMeshVertexBuffer.SetVertexUV(Index, 0, FVector2f(TexCoord.X, TexCoord.Y));
+		MeshData.ColorVertexBuffer.VertexColor(Index) = FColor::White;
 	}
-	m_MeshData.IndexBuffer.Indices.Empty();
-	m_MeshData.IndexBuffer.Indices.Append( (uint32*)Triangles.GetData(), Triangles.Num() );
+	MeshData.IndexBuffer.Indices.Append( (const uint32*)Triangles.GetData(), Triangles.Num() );
 	
 	// 更新本地盒子
 	m_LocalBounds = FBoxSphereBounds(Vertices.GetData(), Vertices.Num());
 
-	// 创建碰撞体
-	//UpdateBodySetup();
+	// 创建碰撞体, 在交给渲染线程之前导出数据
+	if ( m_Collision.Source != EDTMeshCollisionSource::None )
+	{
+		UpdateBodySetup();
+	}
+
+	// 交给场景代理
+	SendMeshData();
+}
+
+// 清空模型
+void UDTHMeshComponent::ClearMesh()
+{
+	m_MeshData.Reset();
+	m_bCPUDataAvailable = false;
+	m_LocalBounds = FBoxSphereBounds(ForceInitToZero);
+	if ( m_Collision.Source != EDTMeshCollisionSource::None )
+	{
+		m_Collision.Clear(this);
+	}
+	SendMeshData();
+}
+
+// 把当前模型缓冲交给场景代理
+void UDTHMeshComponent::SendMeshData()
+{
+	// 已有场景代理时在渲染线程替换缓冲, 旧缓冲由场景代理持有到替换完成, 不需要等待渲染线程
+	FDTHMeshSceneProxy * MeshSceneProxy = static_cast<FDTHMeshSceneProxy*>(SceneProxy);
+	if ( MeshSceneProxy != nullptr && !IsRenderStateDirty() )
+	{
+		if ( m_MeshData.IsValid() && !m_MeshData->bKeepCPUData )
+		{
+			m_bCPUDataAvailable = false;
+		}
+		ENQUEUE_RENDER_COMMAND(SetDTHMeshData)([MeshSceneProxy, MeshData = m_MeshData](FRHICommandListImmediate& RHICmdList)
+		{
+			MeshSceneProxy->SetMeshData_RenderThread(RHICmdList, MeshData);
+		});
+
+		// 更新场景代理的边界
+		UpdateBounds();
+		MarkRenderTransformDirty();
+		return;
+	}
 
 	// 重新绘画
 	MarkRenderStateDirty();
-	
-	return;
 }
 
 
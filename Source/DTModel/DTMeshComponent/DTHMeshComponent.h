@@ -6,18 +6,33 @@
 #include "DynamicMeshBuilder.h"
 #include "MaterialDomain.h"
 #include "Components/MeshComponent.h"
+#include "DTMeshCollision.h"
 #include "DTHMeshComponent.generated.h"
 
 class UDTHMeshComponent;
 
-// CPU保存的模型数据
+// 模型缓冲, 组件和场景代理共享, 最后一个引用释放时在渲染线程删除
+// 不保留CPU数据时, 上传后顶点和索引只保存在GPU
 struct FDTHMeshData
 {
 	FStaticMeshVertexBuffer							StaticMeshVertexBuffer;
 	FPositionVertexBuffer							PositionVertexBuffer;
 	FColorVertexBuffer								ColorVertexBuffer;
 	FDynamicMeshIndexBuffer32						IndexBuffer;
+	int32											NumVertices = 0;			// 点数量, 上传后仍然有效
+	int32											NumIndices = 0;				// 索引数量, 上传后仍然有效
+	bool											bKeepCPUData = true;		// 上传后保留CPU数据, 用于碰撞和编辑
+	bool											bInitialized = false;		// 已经上传 (渲染线程)
+
+	// 析构函数, 释放渲染资源
+	~FDTHMeshData();
+
+	// 创建共享数据
+	static TSharedPtr<FDTHMeshData, ESPMode::ThreadSafe> Create(bool bInKeepCPUData);
+	// 上传到GPU, 多个场景代理共享时只上传一次, 不保留时释放CPU数据 (渲染线程)
+	void InitResources(FRHICommandListBase& RHICmdList);
 };
+typedef TSharedPtr<FDTHMeshData, ESPMode::ThreadSafe> FDTHMeshDataPtr;
 
 
 // 场景代理体
@@ -25,8 +40,8 @@ class FDTHMeshSceneProxy final : public FPrimitiveSceneProxy
 {
 
 public:
-	const bool										m_bHaveMesh;					// 有模型
-	FDTHMeshData&									m_MeshData;						// 模型分块缓冲
+	bool											m_bHaveMesh;					// 有模型 (渲染线程)
+	FDTHMeshDataPtr									m_MeshData;						// 模型缓冲, 与组件共享, 在渲染线程替换
 	UMaterialInterface *							m_MaterialInterface;			// 材质接口
 	FLocalVertexFactory								m_VertexFactory;				// 顶点工厂
 	FMaterialRelevance								m_MaterialRelevance;			// 材质属性
@@ -37,6 +52,13 @@ public:
 	// 析构函数
 	virtual ~FDTHMeshSceneProxy() override;
 
+	// 替换模型缓冲, 组件重新设置模型时不重新创建场景代理 (渲染线程)
+	void SetMeshData_RenderThread(FRHICommandListBase& RHICmdList, const FDTHMeshDataPtr& MeshData);
+
+private:
+	// 上传模型缓冲并绑定顶点工厂 (渲染线程)
+	void BindMeshData(FRHICommandListBase& RHICmdList);
+
 	// 继承函数
 protected:
 	// 返回Hash值
@@ -68,7 +90,13 @@ class DTMODEL_API UDTHMeshComponent : public UMeshComponent, public IInterface_C
 
 private:
 	// 模型数据
-	FDTHMeshData									m_MeshData;			
+	FDTHMeshDataPtr									m_MeshData;
+
+	// 上传后保留CPU数据
+	bool											m_bKeepCPUData;
+
+	// 游戏线程可以读取CPU数据, 不保留时交给场景代理后失效
+	bool											m_bCPUDataAvailable;
 
 	// 场景代理
 	FDTHMeshSceneProxy *							m_MeshSceneProxy;
@@ -77,9 +105,9 @@ private:
 	UPROPERTY(Transient)
 	FBoxSphereBounds								m_LocalBounds;
 
-	// 碰撞体
-	UPROPERTY(Instanced)
-	TObjectPtr<class UBodySetup>					m_BodySetup;
+	// 碰撞体, 直接从顶点缓冲的CPU数据导出
+	UPROPERTY(Transient)
+	FDTMeshCollision								m_Collision;
 	
 public:
 	// 构造函数
@@ -114,7 +142,11 @@ public:
 	// 数据函数
 public:
 	// 获取数据
-	FDTHMeshData& GetMeshData() { return m_MeshData; }
+	const FDTHMeshDataPtr & GetMeshData() const { return m_MeshData; }
+	// 是否保留CPU数据
+	bool IsKeepCPUData() const { return m_bKeepCPUData; }
+	// 游戏线程是否可以读取CPU数据
+	bool IsCPUDataAvailable() const { return m_bCPUDataAvailable; }
 	// 获取场景代理
 	FDTHMeshSceneProxy * GetSceneProxy() const { return m_MeshSceneProxy; }
 	
@@ -122,9 +154,21 @@ public:
 protected:
 	// 更新碰撞体
 	void UpdateBodySetup();
+	// 把当前模型缓冲交给场景代理, 已有场景代理时在渲染线程替换
+	void SendMeshData();
 
 public:
-	// 添加模型
-	void SetMesh(const TArray<FVector>& Vertices, const TArray<int32>& Triangles, const TArray<FVector>& Normals, const TArray<FVector2D>& UVs);
+	// 设置异步生成碰撞体, 生成期间继续使用旧碰撞体
+	void SetAsyncCooking(bool bAsyncCooking) { m_Collision.bAsyncCooking = bAsyncCooking; }
+	// 设置碰撞数据来源, 简化来源按 DecimateSize 合并点, 已有模型时重新生成
+	void SetCollisionSource(EDTMeshCollisionSource Source, double DecimateSize = 0.0);
+	// 设置上传后保留CPU数据, 关闭时只保存在GPU, 渲染模型来源的碰撞只能在 SetMesh 时生成, 下次 SetMesh 生效
+	void SetKeepCPUData(bool bKeepCPUData) { m_bKeepCPUData = bKeepCPUData; }
+	// 使用规则网格作为碰撞, 与渲染精度无关, 已有模型时重新生成
+	void SetCollisionLattice(TConstArrayView<FVector> Points, TConstArrayView<int32> Triangles);
+	// 添加模型, 已有场景代理时在渲染线程替换缓冲, 可以每帧调用
+	void SetMesh(TConstArrayView<FVector> Vertices, TConstArrayView<int32> Triangles, TConstArrayView<FVector> Normals, TConstArrayView<FVector2D> UVs);
+	// 清空模型和碰撞, 释放缓冲, 组件保留注册状态可以重复使用
+	void ClearMesh();
 };
 
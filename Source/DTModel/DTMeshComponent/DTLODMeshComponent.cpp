@@ -4,7 +4,11 @@
 #include "DTLODMeshComponent.h"
 
 #include "DTMeshComponent.h"
+#include "DTModel/DTTools.h"
 #include "Materials/MaterialRenderProxy.h"
+#include "Async/Async.h"
+#include "Async/ParallelFor.h"
+#include "Tasks/Task.h"
 #include "PhysicsEngine/BodySetup.h"
 #include "PhysicsEngine/PhysicsSettings.h"
 
@@ -15,7 +19,8 @@ UE_DISABLE_OPTIMIZATION_SHIP
 FDTLODMeshSceneProxy::FDTLODMeshSceneProxy(UDTLODMeshComponent* DTMeshComponent)
 	: FPrimitiveSceneProxy(DTMeshComponent)
 	, m_MaterialRelevance(DTMeshComponent->GetMaterialRelevance(GetScene().GetFeatureLevel()))
-	, m_LODIndex(DTMeshComponent->GetLODIndex())
+	, m_bDitheredLODTransition(false)
+	, m_MaxPixelError(DTMeshComponent->GetMaxPixelError())
 {
 	TArray<FDTLODMeshCPU> & MeshLODs = DTMeshComponent->GetMeshLODs();
 	for ( int Index = 0; Index < MeshLODs.Num(); ++Index )
@@ -24,8 +29,16 @@ FDTLODMeshSceneProxy::FDTLODMeshSceneProxy(UDTLODMeshComponent* DTMeshComponent)
 		FDTLODMeshGPU * MeshLODGPU = new FDTLODMeshGPU(DTMeshComponent->GetMaterial(0), GetScene().GetFeatureLevel());
 		MeshLODGPU->VertexBuffers.InitFromDynamicVertex(&MeshLODGPU->VertexFactory, MeshLODCPU.Vertices);
 		MeshLODGPU->IndexBuffer.Indices.Append( (uint32*)MeshLODCPU.Triangles.GetData(), MeshLODCPU.Triangles.Num() * 3 );
+		MeshLODGPU->Distances = MeshLODCPU.Distances;
+		MeshLODGPU->GeometricError = MeshLODCPU.GeometricError;
 		m_MeshLODs.Add(MeshLODGPU);
 	}
+
+	// 和 FStaticMeshSceneProxy 一样, 只有不可移动并且材质开启抖动过渡时使用, 动态绘画不支持引擎的抖动过渡
+	if ( m_MeshLODs.Num() > 1 && !IsMovable() )
+	{
+		m_bDitheredLODTransition = m_MeshLODs[0]->MaterialInterface->IsDitheredLODTransition();
+	}
 }
 
 FDTLODMeshSceneProxy::~FDTLODMeshSceneProxy()
@@ -62,8 +75,10 @@ FPrimitiveViewRelevance FDTLODMeshSceneProxy::GetViewRelevance(const FSceneView*
 	FPrimitiveViewRelevance Result;
 	Result.bDrawRelevance = IsShown(View);
 	Result.bShadowRelevance = IsShadowCast(View);
-	Result.bDynamicRelevance = true;
-	Result.bStaticRelevance = false;
+	// 抖动过渡使用静态绘画, 线框模式使用动态绘画
+	const bool bStaticPath = m_bDitheredLODTransition && !(AllowDebugViewmodes() && View->Family->EngineShowFlags.Wireframe);
+	Result.bDynamicRelevance = !bStaticPath;
+	Result.bStaticRelevance = bStaticPath;
 	Result.bRenderInMainPass = ShouldRenderInMainPass();
 	Result.bUsesLightingChannels = GetLightingChannelMask() != GetDefaultLightingChannelMask();
 	Result.bRenderCustomDepth = ShouldRenderCustomDepth();
@@ -114,97 +129,202 @@ void FDTLODMeshSceneProxy::GetDynamicMeshElements(const TArray<const FSceneView*
 		Collector.RegisterOneFrameMaterialProxy(WireframeMaterialInstance);
 	}
 
-	// 遍历所有部件
-	if ( m_MeshLODs.IsValidIndex(m_LODIndex) )
+	// 遍历所有视图, 每个视图使用自己的LOD
+	for (int32 ViewIndex = 0; ViewIndex < Views.Num(); ViewIndex++)
 	{
-		// 获取数据
-		const FDTLODMeshGPU * MeshLOD = m_MeshLODs[m_LODIndex];
-		
-		// 获取材质绘画材质
-		FMaterialRenderProxy* MaterialProxy = bWireframe ? WireframeMaterialInstance : MeshLOD->MaterialInterface->GetRenderProxy();
-
-		// 遍历所有视图
-		for (int32 ViewIndex = 0; ViewIndex < Views.Num(); ViewIndex++)
+		if (VisibilityMap & (1 << ViewIndex))
 		{
-			if (VisibilityMap & (1 << ViewIndex))
+			const int32 LODIndex = GetLOD(Views[ViewIndex]);
+			if ( !m_MeshLODs.IsValidIndex(LODIndex) )
 			{
-				// 绘画模型
-				FMeshBatch& Mesh = Collector.AllocateMesh();
-				FMeshBatchElement& BatchElement = Mesh.Elements[0];
-				Mesh.bWireframe = bWireframe;
-				Mesh.VertexFactory = &MeshLOD->VertexFactory;
-				Mesh.MaterialRenderProxy = MaterialProxy;
-				Mesh.ReverseCulling = IsLocalToWorldDeterminantNegative();
-				Mesh.Type = PT_TriangleList;
-				Mesh.DepthPriorityGroup = SDPG_World;
-				Mesh.bCanApplyViewModeOverrides = false;
-
-				bool bHasPrecomputedVolumetricLightmap;
-				FMatrix PreviousLocalToWorld;
-				int32 SingleCaptureIndex;
-				bool bOutputVelocity;
-				GetScene().GetPrimitiveUniformShaderParameters_RenderThread(GetPrimitiveSceneInfo(), bHasPrecomputedVolumetricLightmap, PreviousLocalToWorld, SingleCaptureIndex, bOutputVelocity);
-				bOutputVelocity |= AlwaysHasVelocity();
-
-				FDynamicPrimitiveUniformBuffer& DynamicPrimitiveUniformBuffer = Collector.AllocateOneFrameResource<FDynamicPrimitiveUniformBuffer>();
-				DynamicPrimitiveUniformBuffer.Set(Collector.GetRHICommandList(), GetLocalToWorld(), PreviousLocalToWorld, GetBounds(), GetLocalBounds(), GetLocalBounds(), ReceivesDecals(), bHasPrecomputedVolumetricLightmap, bOutputVelocity, GetCustomPrimitiveData());
-				BatchElement.PrimitiveUniformBufferResource = &DynamicPrimitiveUniformBuffer.UniformBuffer;
-				
-				BatchElement.IndexBuffer = &MeshLOD->IndexBuffer;
-				BatchElement.FirstIndex = 0;
-				BatchElement.NumPrimitives = MeshLOD->IndexBuffer.Indices.Num() / 3;
-				BatchElement.MinVertexIndex = 0;
-				BatchElement.MaxVertexIndex = MeshLOD->VertexBuffers.PositionVertexBuffer.GetNumVertices() - 1;
-
-				Collector.AddMesh(ViewIndex, Mesh);
+				continue;
 			}
+
+			// 获取数据
+			const FDTLODMeshGPU * MeshLOD = m_MeshLODs[LODIndex];
+		
+			// 获取材质绘画材质
+			FMaterialRenderProxy* MaterialProxy = bWireframe ? WireframeMaterialInstance : MeshLOD->MaterialInterface->GetRenderProxy();
+
+			// 绘画模型
+			FMeshBatch& Mesh = Collector.AllocateMesh();
+			FMeshBatchElement& BatchElement = Mesh.Elements[0];
+			SetupMeshBatch(Mesh, LODIndex, MaterialProxy, bWireframe);
+
+			bool bHasPrecomputedVolumetricLightmap;
+			FMatrix PreviousLocalToWorld;
+			int32 SingleCaptureIndex;
+			bool bOutputVelocity;
+			GetScene().GetPrimitiveUniformShaderParameters_RenderThread(GetPrimitiveSceneInfo(), bHasPrecomputedVolumetricLightmap, PreviousLocalToWorld, SingleCaptureIndex, bOutputVelocity);
+			bOutputVelocity |= AlwaysHasVelocity();
+
+			FDynamicPrimitiveUniformBuffer& DynamicPrimitiveUniformBuffer = Collector.AllocateOneFrameResource<FDynamicPrimitiveUniformBuffer>();
+			DynamicPrimitiveUniformBuffer.Set(Collector.GetRHICommandList(), GetLocalToWorld(), PreviousLocalToWorld, GetBounds(), GetLocalBounds(), GetLocalBounds(), ReceivesDecals(), bHasPrecomputedVolumetricLightmap, bOutputVelocity, GetCustomPrimitiveData());
+			BatchElement.PrimitiveUniformBufferResource = &DynamicPrimitiveUniformBuffer.UniformBuffer;
+
+			Collector.AddMesh(ViewIndex, Mesh);
 		}
 	}
 }
 
+// 绘画静态元素
+void FDTLODMeshSceneProxy::DrawStaticElements(FStaticPrimitiveDrawInterface* PDI)
+{
+	if ( !m_bDitheredLODTransition )
+	{
+		return;
+	}
+
+	// 引擎按屏幕大小为每个视图选择LOD, 切换时两层LOD使用互补的抖动同时绘画
+	for ( int32 LODIndex = 0; LODIndex < m_MeshLODs.Num(); ++LODIndex )
+	{
+		FMeshBatch Mesh;
+		SetupMeshBatch(Mesh, LODIndex, m_MeshLODs[LODIndex]->MaterialInterface->GetRenderProxy(), false);
+		Mesh.bDitheredLODTransition = true;
+		Mesh.CastShadow = true;
+		Mesh.Elements[0].PrimitiveUniformBuffer = GetUniformBuffer();
+		PDI->DrawMesh(Mesh, GetScreenSize(LODIndex));
+	}
+}
 
-// --------------------------------------------------------------------------
-// 模型组件 构造函数
-UDTLODMeshComponent::UDTLODMeshComponent(const FObjectInitializer& ObjectInitializer)
-	: Super(ObjectInitializer)
-	, m_MeshSceneProxy( nullptr )
-	, m_LocalBounds( ForceInitToZero )
-	, m_LODIndex(0)
+// 填充LOD的绘画数据
+void FDTLODMeshSceneProxy::SetupMeshBatch(FMeshBatch& Mesh, int32 LODIndex, FMaterialRenderProxy* MaterialProxy, bool bWireframe) const
 {
-	PrimaryComponentTick.bCanEverTick = true;
+	const FDTLODMeshGPU * MeshLOD = m_MeshLODs[LODIndex];
+	FMeshBatchElement& BatchElement = Mesh.Elements[0];
+	Mesh.bWireframe = bWireframe;
+	Mesh.VertexFactory = &MeshLOD->VertexFactory;
+	Mesh.MaterialRenderProxy = MaterialProxy;
+	Mesh.ReverseCulling = IsLocalToWorldDeterminantNegative();
+	Mesh.Type = PT_TriangleList;
+	Mesh.DepthPriorityGroup = SDPG_World;
+	Mesh.bCanApplyViewModeOverrides = false;
+	Mesh.LODIndex = LODIndex;
+
+	BatchElement.IndexBuffer = &MeshLOD->IndexBuffer;
+	BatchElement.FirstIndex = 0;
+	BatchElement.NumPrimitives = MeshLOD->IndexBuffer.Indices.Num() / 3;
+	BatchElement.MinVertexIndex = 0;
+	BatchElement.MaxVertexIndex = MeshLOD->VertexBuffers.PositionVertexBuffer.GetNumVertices() - 1;
 }
 
-// 开始播放
-void UDTLODMeshComponent::BeginPlay()
+// LOD开始使用的屏幕大小
+float FDTLODMeshSceneProxy::GetScreenSize(int32 LODIndex) const
 {
-	Super::BeginPlay();
+	static constexpr float MaxScreenSize = 1.0e4f;
+	if ( LODIndex <= 0 )
+	{
+		return MaxScreenSize;
+	}
+
+	// 屏幕误差: 误差像素 = 偏差 * 0.5 * 宽度 * M[0][0] / 深度, 屏幕直径 = 半径 * M[0][0] / 深度
+	// 静态绘画的屏幕大小和分辨率无关, 按参考宽度换算
+	if ( m_MaxPixelError > 0.0f )
+	{
+		static constexpr double ReferenceWidth = 1920.0;
+		const double GeometricError = m_MeshLODs[LODIndex]->GeometricError * GetLocalToWorld().GetMaximumAxisScale();
+		if ( GeometricError <= UE_KINDA_SMALL_NUMBER )
+		{
+			return MaxScreenSize;
+		}
+		return FMath::Clamp(static_cast<float>(2.0 * m_MaxPixelError * GetBounds().SphereRadius / (GeometricError * ReferenceWidth)), UE_SMALL_NUMBER, MaxScreenSize);
+	}
+
+	// 第 N 层从第 N-1 层的显示距离开始使用, 90 度视角时屏幕直径为 半径 / 距离, 和 GetLOD 的换算一致
+	const double Distances = m_MeshLODs[LODIndex - 1]->Distances;
+	if ( Distances <= UE_KINDA_SMALL_NUMBER )
+	{
+		return MaxScreenSize;
+	}
+	return FMath::Clamp(static_cast<float>(GetBounds().SphereRadius / Distances), UE_SMALL_NUMBER, MaxScreenSize);
 }
 
-// 每帧函数
-void UDTLODMeshComponent::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
+// 返回视图使用的LOD
+int32 FDTLODMeshSceneProxy::GetLOD(const FSceneView* View) const
 {
-	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+	if ( !m_MeshLODs.Num() )
+	{
+		return INDEX_NONE;
+	}
+	const int32 LastLOD = m_MeshLODs.Num() - 1;
+
+	// 控制台强制LOD和只绘画最低LOD的视图
+	const int32 ForcedLOD = GetCVarForceLOD();
+	if ( ForcedLOD >= 0 )
+	{
+		return FMath::Min(ForcedLOD, LastLOD);
+	}
+	if ( View->DrawDynamicFlags & EDrawDynamicFlags::ForceLowestLOD )
+	{
+		return LastLOD;
+	}
 
-	// 获取玩家摄像机位置
-	const FVector & CameraLocation = GetWorld()->GetFirstPlayerController()->PlayerCameraManager->GetCameraLocation();
+	// 几何偏差投影到屏幕像素, 选择误差不超过阈值的最低精度LOD, 视角和分辨率变化时一致
+	if ( m_MaxPixelError > 0.0f )
+	{
+		const double PixelScale = GetPixelScale(*View);
+		for ( int32 LODIndex = LastLOD; LODIndex > 0; --LODIndex )
+		{
+			if ( m_MeshLODs[LODIndex]->GeometricError * PixelScale <= m_MaxPixelError )
+			{
+				return LODIndex;
+			}
+		}
+		return 0;
+	}
 
-	// 计算当前距离d
-	double Distances = FVector::Distance( CalcBounds(GetComponentTransform()).Origin, CameraLocation );
-	int LODIndex = 0;
-	for ( ; LODIndex < m_MeshLODs.Num(); ++LODIndex  )
+	// 和 ComputeStaticMeshLOD 一样使用屏幕大小, 再换算成 90 度视角下的等效距离和显示距离比较
+	// 视角变窄 (望远镜, 场景捕获) 时等效距离变近, 分屏和阴影视图各自计算
+	const FBoxSphereBounds & ProxyBounds = GetBounds();
+	double Distances = FVector::Distance(ProxyBounds.Origin, View->ViewMatrices.GetViewOrigin());
+	const float ScreenRadiusSquared = ComputeBoundsScreenRadiusSquared(ProxyBounds.Origin, ProxyBounds.SphereRadius, *View) * FMath::Square(View->LODDistanceFactor);
+	if ( ProxyBounds.SphereRadius > UE_KINDA_SMALL_NUMBER && ScreenRadiusSquared > UE_SMALL_NUMBER )
 	{
-		FDTLODMeshCPU & MeshLOD = m_MeshLODs[LODIndex];
-		if ( Distances <  MeshLOD.Distances )
+		Distances = 0.5 * ProxyBounds.SphereRadius / FMath::Sqrt(ScreenRadiusSquared);
+	}
+
+	for ( int32 LODIndex = 0; LODIndex < LastLOD; ++LODIndex )
+	{
+		if ( Distances < m_MeshLODs[LODIndex]->Distances )
 		{
-			SetLOD(LODIndex);
-			break;
+			return LODIndex;
 		}
 	}
-	if ( LODIndex == m_MeshLODs.Num() )
+	return LastLOD;
+}
+
+// 视图中本地单位长度的像素数
+double FDTLODMeshSceneProxy::GetPixelScale(const FSceneView& View) const
+{
+	// 输出分辨率下的像素, 不受屏幕百分比影响, 深度取包围球最近点
+	const FMatrix & ProjectionMatrix = View.ViewMatrices.GetProjectionMatrix();
+	double PixelScale = 0.5 * View.UnscaledViewRect.Width() * ProjectionMatrix.M[0][0] * View.LODDistanceFactor * GetLocalToWorld().GetMaximumAxisScale();
+	if ( View.IsPerspectiveProjection() )
 	{
-		SetLOD(m_MeshLODs.Num() - 1);
+		const FBoxSphereBounds & ProxyBounds = GetBounds();
+		PixelScale /= FMath::Max(1.0, FVector::Distance(ProxyBounds.Origin, View.ViewMatrices.GetViewOrigin()) - ProxyBounds.SphereRadius);
 	}
-	
+	return PixelScale;
+}
+
+
+// --------------------------------------------------------------------------
+// 模型组件 构造函数
+UDTLODMeshComponent::UDTLODMeshComponent(const FObjectInitializer& ObjectInitializer)
+	: Super(ObjectInitializer)
+	, m_MeshSceneProxy( nullptr )
+	, m_LocalBounds( ForceInitToZero )
+	, m_MaxPixelError( 0.0f )
+	, m_BuildSerial( 0 )
+{
+	// LOD在绘画线程按视图选择, 不需要每帧函数
+	PrimaryComponentTick.bCanEverTick = false;
+}
+
+// 开始播放
+void UDTLODMeshComponent::BeginPlay()
+{
+	Super::BeginPlay();
 }
 
 // 场景代理
@@ -217,15 +337,7 @@ FPrimitiveSceneProxy* UDTLODMeshComponent::CreateSceneProxy()
 // 碰撞代理
 UBodySetup* UDTLODMeshComponent::GetBodySetup()
 {
-	if ( m_BodySetup == nullptr )
-	{
-		m_BodySetup = NewObject<UBodySetup>(this, NAME_None, (IsTemplate() ? RF_Public | RF_ArchetypeObject : RF_NoFlags));
-		m_BodySetup->BodySetupGuid = FGuid::NewGuid();
-		m_BodySetup->bGenerateMirroredCollision = false;
-		m_BodySetup->bDoubleSidedGeometry = true;
-		m_BodySetup->CollisionTraceFlag = CTF_UseComplexAsSimple;
-	}
-	return m_BodySetup;
+	return m_Collision.GetBodySetup(this);
 }
 
 // 返回场景大小
@@ -256,44 +368,52 @@ bool UDTLODMeshComponent::GetTriMeshSizeEstimates(FTriMeshCollisionDataEstimates
 // 返回碰撞数据
 bool UDTLODMeshComponent::GetPhysicsTriMeshData(FTriMeshCollisionData* CollisionData, bool InUseAllTriData)
 {
-	// UV碰撞体
-	bool bCopyUVs = UPhysicsSettings::Get()->bSupportUVFromHitResults; 
-	if ( bCopyUVs )
+	// 简化模型
+	if ( m_Collision.IsProxy() )
 	{
-		// 先只设置一层UV
-		CollisionData->UVs.AddZeroed(1); 
+		m_Collision.ExportProxy(CollisionData);
+		CollisionData->bFlipNormals = true;
+		CollisionData->bDeformableMesh = true;
+		CollisionData->bFastCook = true;
+		return true;
+	}
+
+	// 分块生成时只导出当前分块, 合并后的碰撞体没有UV
+	const int32 CollisionLOD = GetCollisionLOD();
+	if ( m_Collision.ExportChunk != INDEX_NONE )
+	{
+		const FDTLODMeshCPU & LODMesh = m_MeshLODs[CollisionLOD];
+		m_Collision.ExportChunkTriangles(CollisionData,
+			[&LODMesh](const FIntPoint & Triangle) { return LODMesh.Triangles[Triangle.Y]; },
+			[&LODMesh](int32 SectionIndex, int32 VertexIndex) { return LODMesh.Vertices[VertexIndex].Position; });
+		CollisionData->bFlipNormals = true;
+		CollisionData->bDeformableMesh = true;
+		CollisionData->bFastCook = true;
+		return true;
 	}
 	
-	// 只添加0层LOD
-	if ( m_MeshLODs.Num() )
+	// UV碰撞体
+	const bool bCopyUVs = UPhysicsSettings::Get()->bSupportUVFromHitResults; 
+	
+	// 只添加设置的LOD
+	if ( CollisionLOD != INDEX_NONE )
 	{
 		// 获取模型组件
-		FDTLODMeshCPU & LODMesh = m_MeshLODs[0];
+		const FDTLODMeshCPU & LODMesh = m_MeshLODs[CollisionLOD];
+		FDTMeshCollision::AllocateTriMeshData(CollisionData, LODMesh.Vertices.Num(), LODMesh.Triangles.Num(), bCopyUVs);
 
 		// 获取点数据
-		for (int32 VertIndex = 0; VertIndex < LODMesh.Vertices.Num(); VertIndex++)
+		ParallelFor(LODMesh.Vertices.Num(), [&](int32 VertIndex)
 		{
-			CollisionData->Vertices.Add(LODMesh.Vertices[VertIndex].Position);
-			
+			CollisionData->Vertices[VertIndex] = LODMesh.Vertices[VertIndex].Position;
 			if ( bCopyUVs )
 			{
-				CollisionData->UVs[0].Add(FVector2D(LODMesh.Vertices[VertIndex].TextureCoordinate[0]));
+				CollisionData->UVs[0][VertIndex] = FVector2D(LODMesh.Vertices[VertIndex].TextureCoordinate[0]);
 			}
-		}
+		});
 
 		// 获取三角形数据
-		for (int32 TriIndex = 0; TriIndex < LODMesh.Triangles.Num(); TriIndex++)
-		{
-			// 保存偏移后三角形
-			FTriIndices Triangle;
-			Triangle.v0 = LODMesh.Triangles[TriIndex].X;
-			Triangle.v1 = LODMesh.Triangles[TriIndex].Y;
-			Triangle.v2 = LODMesh.Triangles[TriIndex].Z;
-			CollisionData->Indices.Add(Triangle);
-
-			// 保存材质索引
-			CollisionData->MaterialIndices.Add(0);
-		}
+		FDTMeshCollision::CopyTriangles(CollisionData, 0, 0, LODMesh.Triangles, 0);
 	}
 	
 	CollisionData->bFlipNormals = true;
@@ -306,31 +426,113 @@ bool UDTLODMeshComponent::GetPhysicsTriMeshData(FTriMeshCollisionData* Collision
 // 返回碰撞支持
 bool UDTLODMeshComponent::ContainsPhysicsTriMeshData(bool InUseAllTriData) const
 {
-	return !!m_MeshLODs.Num();
+	return m_Collision.Source != EDTMeshCollisionSource::None && !!m_MeshLODs.Num();
 }
 
 // 更新碰撞体
 void UDTLODMeshComponent::UpdateBodySetup()
 {
-	if ( UBodySetup* BodySetup = GetBodySetup() )
+	// 简化模型从设置的LOD生成
+	const int32 CollisionLOD = GetCollisionLOD();
+	if ( m_Collision.Source == EDTMeshCollisionSource::Decimated )
+	{
+		m_Collision.ResetProxy();
+		if ( CollisionLOD != INDEX_NONE )
+		{
+			const FDTLODMeshCPU & LODMesh = m_MeshLODs[CollisionLOD];
+			TArray<FVector3f> Positions;
+			Positions.SetNumUninitialized(LODMesh.Vertices.Num());
+			for ( int32 Index = 0; Index < LODMesh.Vertices.Num(); ++Index )
+			{
+				Positions[Index] = LODMesh.Vertices[Index].Position;
+			}
+			m_Collision.AppendDecimated(Positions, LODMesh.Triangles, 0);
+		}
+	}
+	RebuildCollisionChunks();
+	m_Collision.Cook(this, true);
+}
+
+// 碰撞使用的LOD
+int32 UDTLODMeshComponent::GetCollisionLOD() const
+{
+	if ( !m_MeshLODs.Num() )
+	{
+		return INDEX_NONE;
+	}
+	return FMath::Clamp(m_Collision.SourceLOD, 0, m_MeshLODs.Num() - 1);
+}
+
+// 设置碰撞数据来源
+void UDTLODMeshComponent::SetCollisionSource(EDTMeshCollisionSource Source, int32 LODIndex, double DecimateSize)
+{
+	// 规则网格只由地形提供
+	if ( Source != EDTMeshCollisionSource::Lattice )
 	{
-		BodySetup->bHasCookedCollisionData = true;
-		BodySetup->InvalidatePhysicsData();
-		BodySetup->CreatePhysicsMeshes();
-		RecreatePhysicsState();
+		m_Collision.Source = Source;
+		m_Collision.SourceLOD = LODIndex;
+		m_Collision.DecimateSize = DecimateSize;
 	}
 }
 
-// 设置当前显示LOD
-void UDTLODMeshComponent::SetLOD(int LODIndex)
+// 重新划分碰撞分块
+void UDTLODMeshComponent::RebuildCollisionChunks()
 {
-	if ( m_LODIndex != LODIndex )
+	m_Collision.ResetChunks();
+	const int32 CollisionLOD = GetCollisionLOD();
+	if ( !m_Collision.IsChunked() || CollisionLOD == INDEX_NONE )
 	{
-		m_LODIndex = LODIndex;
-		ENQUEUE_RENDER_COMMAND(UpdateLODIndex)([this](FRHICommandListImmediate& RHICmdList)
+		return;
+	}
+	const FDTLODMeshCPU & LODMesh = m_MeshLODs[CollisionLOD];
+	for ( int32 TriIndex = 0; TriIndex < LODMesh.Triangles.Num(); ++TriIndex )
+	{
+		const FUintVector & Triangle = LODMesh.Triangles[TriIndex];
+		const FVector3f Center = (LODMesh.Vertices[Triangle.X].Position + LODMesh.Vertices[Triangle.Y].Position + LODMesh.Vertices[Triangle.Z].Position) / 3.0f;
+		m_Collision.AddChunkTriangle(FIntPoint(0, TriIndex), Center);
+	}
+}
+
+// 测量每层LOD与第0层的几何偏差
+void UDTLODMeshComponent::MeasureGeometricErrors()
+{
+	if ( !m_MeshLODs.Num() )
+	{
+		return;
+	}
+
+	// 第0层的点到每层表面的最大距离
+	TArray<FVector3f> BasePositions;
+	const FDTLODMeshCPU & BaseLOD = m_MeshLODs[0];
+	BasePositions.SetNumUninitialized(BaseLOD.Vertices.Num());
+	for ( int32 Index = 0; Index < BaseLOD.Vertices.Num(); ++Index )
+	{
+		BasePositions[Index] = BaseLOD.Vertices[Index].Position;
+	}
+	m_MeshLODs[0].GeometricError = 0.0;
+
+	TArray<FVector3f> Positions;
+	for ( int32 LODIndex = 1; LODIndex < m_MeshLODs.Num(); ++LODIndex )
+	{
+		FDTLODMeshCPU & MeshLOD = m_MeshLODs[LODIndex];
+		Positions.SetNumUninitialized(MeshLOD.Vertices.Num());
+		for ( int32 Index = 0; Index < MeshLOD.Vertices.Num(); ++Index )
 		{
-			m_MeshSceneProxy->m_LODIndex = m_LODIndex;
-		});
+			Positions[Index] = MeshLOD.Vertices[Index].Position;
+		}
+
+		// 误差不随层数减小, 选择LOD时可以从最低精度向上查找
+		MeshLOD.GeometricError = FMath::Max(UDTTools::MeasureMeshDeviation(BasePositions, Positions, MeshLOD.Triangles), m_MeshLODs[LODIndex - 1].GeometricError);
+	}
+}
+
+// 设置LOD允许的最大屏幕误差
+void UDTLODMeshComponent::SetMaxPixelError(float MaxPixelError)
+{
+	if ( m_MaxPixelError != MaxPixelError )
+	{
+		m_MaxPixelError = MaxPixelError;
+		MarkRenderStateDirty();
 	}
 }
 
@@ -338,6 +540,7 @@ void UDTLODMeshComponent::SetLOD(int LODIndex)
 void UDTLODMeshComponent::ClearMesh()
 {
 	m_MeshLODs.Empty();
+	++m_BuildSerial;
 }
 
 // 创建模型
@@ -370,6 +573,7 @@ int UDTLODMeshComponent::AddMeshLOD(const TArray<FVector>& Vertices, const TArra
 	}
 	MeshLOD.LocalBox = FBoxSphereBounds(Vertices.GetData(), Vertices.Num());
 	MeshLOD.Distances = DisplaysDistances;
+	MeshLOD.GeometricError = 0.0;
 	
 	return LODIndex;
 }
@@ -383,8 +587,100 @@ void UDTLODMeshComponent::AddFinish()
 		// 更新本地盒子
 		m_LocalBounds = m_MeshLODs.HeapTop().LocalBox;
 
+		// 测量几何偏差
+		MeasureGeometricErrors();
+
 		// 创建碰撞体
-		//UpdateBodySetup();
+		if ( m_Collision.Source != EDTMeshCollisionSource::None )
+		{
+			UpdateBodySetup();
+		}
+	}
+
+	// 重新绘画
+	MarkRenderStateDirty();
+}
+
+// 自动生成LOD
+void UDTLODMeshComponent::BuildMeshLODs(const TArray<FVector>& Vertices, const TArray<int32>& Triangles, const TArray<FVector>& Normals, const TArray<FVector2D>& UVs, int64 DisplaysDistances, const TArray<FDTLODMeshBuildLevel>& Levels, bool bPreserveBorders)
+{
+	// 第0层立即显示
+	ClearMesh();
+	AddMeshLOD(Vertices, Triangles, Normals, UVs, DisplaysDistances);
+	AddFinish();
+	if ( !Levels.Num() )
+	{
+		return;
+	}
+
+	// 每层都从第0层简化, 各层并行
+	const uint32 BuildSerial = m_BuildSerial;
+	const int32 TriangleCount = Triangles.Num() / 3;
+	UE::Tasks::Launch(UE_SOURCE_LOCATION, [WeakThis = TWeakObjectPtr<UDTLODMeshComponent>(this), BuildSerial, TriangleCount, Vertices, Triangles, Normals, UVs, Levels, bPreserveBorders]()
+	{
+		// 第0层的点, 用于测量各层的几何偏差
+		TArray<FVector3f> BasePositions;
+		BasePositions.SetNumUninitialized(Vertices.Num());
+		for ( int32 Index = 0; Index < Vertices.Num(); ++Index )
+		{
+			BasePositions[Index] = FVector3f(Vertices[Index]);
+		}
+
+		TArray<FDTLODMeshBuildResult> ArrayResult;
+		ArrayResult.SetNum(Levels.Num());
+		ParallelFor(Levels.Num(), [&](int32 LevelIndex)
+		{
+			FDTLODMeshBuildResult & Result = ArrayResult[LevelIndex];
+			const int32 TargetTriangleCount = FMath::RoundToInt32(TriangleCount * FMath::Clamp(Levels[LevelIndex].TriangleRatio, 0.0f, 1.0f));
+			UDTTools::SimplifyMesh(Vertices, Triangles, Normals, UVs, TargetTriangleCount, bPreserveBorders, Result.Points, Result.Triangles, Result.Normals, Result.UVs);
+			Result.DisplaysDistances = Levels[LevelIndex].DisplaysDistances;
+
+			// 几何偏差在生成线程测量, 不占用游戏线程
+			TArray<FVector3f> Positions;
+			Positions.SetNumUninitialized(Result.Points.Num());
+			for ( int32 Index = 0; Index < Result.Points.Num(); ++Index )
+			{
+				Positions[Index] = FVector3f(Result.Points[Index]);
+			}
+			TArray<FUintVector> ResultTriangles;
+			ResultTriangles.Reserve(Result.Triangles.Num() / 3);
+			for ( int32 Index = 0; Index + 2 < Result.Triangles.Num(); Index += 3 )
+			{
+				ResultTriangles.Emplace(Result.Triangles[Index], Result.Triangles[Index + 1], Result.Triangles[Index + 2]);
+			}
+			Result.GeometricError = UDTTools::MeasureMeshDeviation(BasePositions, Positions, ResultTriangles);
+		});
+
+		AsyncTask(ENamedThreads::GameThread, [WeakThis, BuildSerial, ArrayResult = MoveTemp(ArrayResult)]() mutable
+		{
+			if ( UDTLODMeshComponent * Component = WeakThis.Get() )
+			{
+				Component->OnMeshLODsBuilt(BuildSerial, MoveTemp(ArrayResult));
+			}
+		});
+	});
+}
+
+// 自动生成的LOD完成
+void UDTLODMeshComponent::OnMeshLODsBuilt(uint32 BuildSerial, TArray<FDTLODMeshBuildResult>&& ArrayResult)
+{
+	// 生成期间清空或重新生成过
+	if ( BuildSerial != m_BuildSerial || !m_MeshLODs.Num() )
+	{
+		return;
+	}
+
+	// 添加各层, 碰撞只在使用的LOD变化时重新生成
+	const int32 CollisionLOD = GetCollisionLOD();
+	for ( const FDTLODMeshBuildResult & Result : ArrayResult )
+	{
+		// 误差不随层数减小, 选择LOD时可以从最低精度向上查找
+		const int LODIndex = AddMeshLOD(Result.Points, Result.Triangles, Result.Normals, Result.UVs, Result.DisplaysDistances);
+		m_MeshLODs[LODIndex].GeometricError = FMath::Max(Result.GeometricError, m_MeshLODs[LODIndex - 1].GeometricError);
+	}
+	if ( m_Collision.Source != EDTMeshCollisionSource::None && GetCollisionLOD() != CollisionLOD )
+	{
+		UpdateBodySetup();
 	}
 
 	// 重新绘画
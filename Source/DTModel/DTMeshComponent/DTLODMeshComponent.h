@@ -6,6 +6,7 @@
 #include "DynamicMeshBuilder.h"
 #include "MaterialDomain.h"
 #include "Components/MeshComponent.h"
+#include "DTMeshCollision.h"
 #include "DTLODMeshComponent.generated.h"
 
 class UDTLODMeshComponent;
@@ -17,10 +18,14 @@ struct FDTLODMeshGPU
 	FStaticMeshVertexBuffers						VertexBuffers;				// GPU顶点缓存
 	FLocalVertexFactory								VertexFactory;				// GPU顶点代理
 	FDynamicMeshIndexBuffer32						IndexBuffer;				// 索引缓存
+	double											Distances;					// 显示距离
+	double											GeometricError;				// 与第0层的最大几何偏差, 本地坐标
 
 	FDTLODMeshGPU(UMaterialInterface * InMaterialInterface, ERHIFeatureLevel::Type InFeatureLevel)
 	: MaterialInterface(InMaterialInterface ? InMaterialInterface : UMaterial::GetDefaultMaterial(MD_Surface))
 	, VertexFactory(InFeatureLevel, "FDTLODMeshGPU")
+	, Distances(0.0)
+	, GeometricError(0.0)
 	{}
 };
 
@@ -31,7 +36,8 @@ class FDTLODMeshSceneProxy final : public FPrimitiveSceneProxy
 public:
 	TArray<FDTLODMeshGPU*>							m_MeshLODs;						// 模型分块缓冲
 	FMaterialRelevance								m_MaterialRelevance;			// 材质属性
-	int												m_LODIndex;						// LOD索引
+	bool											m_bDitheredLODTransition;		// 抖动过渡LOD, 使用静态绘画由引擎按视图选择和过渡
+	float											m_MaxPixelError;				// LOD允许的最大屏幕误差(像素), 小于等于 0 时使用显示距离
 
 public:
 	// 构造函数
@@ -57,17 +63,48 @@ protected:
 #endif
 	// 绘画动态元素
 	virtual void GetDynamicMeshElements(const TArray<const FSceneView*>& Views, const FSceneViewFamily& ViewFamily, uint32 VisibilityMap, FMeshElementCollector& Collector) const override;
+	// 返回视图使用的LOD, 每个视图单独计算
+	virtual int32 GetLOD(const FSceneView* View) const override;
+	// 绘画静态元素, 所有LOD按屏幕大小提交, 只有抖动过渡时使用
+	virtual void DrawStaticElements(FStaticPrimitiveDrawInterface* PDI) override;
+
+private:
+	// 填充LOD的绘画数据
+	void SetupMeshBatch(FMeshBatch& Mesh, int32 LODIndex, FMaterialRenderProxy* MaterialProxy, bool bWireframe) const;
+	// LOD开始使用的屏幕大小, 由显示距离或屏幕误差换算
+	float GetScreenSize(int32 LODIndex) const;
+	// 视图中本地单位长度在距离 1 处的像素数
+	double GetPixelScale(const FSceneView& View) const;
 };
 
 // CPU保存的模型数据
 struct FDTLODMeshCPU
 {
 	double											Distances;				// 显示距离
+	double											GeometricError;			// 与第0层的最大几何偏差, AddFinish 时测量
 	FBoxSphereBounds								LocalBox;				// 本地盒子
 	TArray<FDynamicMeshVertex>						Vertices;				// 点位置数据
 	TArray<FUintVector>								Triangles;				// 三角形索引
 };
 
+// 自动生成LOD的层级参数
+struct FDTLODMeshBuildLevel
+{
+	float											TriangleRatio;			// 相对第0层的三角面比例
+	int64											DisplaysDistances;		// 显示距离, 使用屏幕误差时不使用
+};
+
+// 自动生成的LOD数据
+struct FDTLODMeshBuildResult
+{
+	TArray<FVector>									Points;					// 点位置数据
+	TArray<int32>									Triangles;				// 三角面索引
+	TArray<FVector>									Normals;				// 点法线数据
+	TArray<FVector2D>								UVs;					// UV
+	int64											DisplaysDistances;		// 显示距离
+	double											GeometricError;			// 与第0层的几何偏差, 在生成线程测量
+};
+
 // 自定义LOD渲染
 UCLASS(ClassGroup=(DT), meta=(BlueprintSpawnableComponent))
 class DTMODEL_API UDTLODMeshComponent : public UMeshComponent, public IInterface_CollisionDataProvider
@@ -77,7 +114,6 @@ class DTMODEL_API UDTLODMeshComponent : public UMeshComponent, public IInterface
 private:
 	// 模型数据
 	TArray<FDTLODMeshCPU>							m_MeshLODs;
-	int												m_LODIndex;
 
 	// 场景代理
 	FDTLODMeshSceneProxy *							m_MeshSceneProxy;
@@ -86,9 +122,15 @@ private:
 	UPROPERTY(Transient)
 	FBoxSphereBounds								m_LocalBounds;
 
-	// 碰撞体
-	UPROPERTY(Instanced)
-	TObjectPtr<class UBodySetup>					m_BodySetup;
+	// LOD允许的最大屏幕误差(像素), 小于等于 0 时使用显示距离
+	float											m_MaxPixelError;
+
+	// 自动生成LOD的序号, 清空或重新生成后旧的结果丢弃
+	uint32											m_BuildSerial;
+
+	// 碰撞体, 异步生成时旧碰撞体使用到新碰撞体完成
+	UPROPERTY(Transient)
+	FDTMeshCollision								m_Collision;
 	
 public:
 	// 构造函数
@@ -97,8 +139,6 @@ public:
 protected:
 	// 开始播放
 	virtual void BeginPlay() override;
-	// 每帧函数
-	virtual void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
 	
 	// 组件继承回调
 public:
@@ -122,25 +162,42 @@ public:
 
 	// 数据函数
 public:
-	// 获取LOD索引
-	int GetLODIndex() const { return m_LODIndex; }
 	// 获取数据
 	TArray<FDTLODMeshCPU> & GetMeshLODs() { return m_MeshLODs; }
 	// 获取场景代理
 	FDTLODMeshSceneProxy * GetSceneProxy() const { return m_MeshSceneProxy; }
+	// 获取LOD允许的最大屏幕误差
+	float GetMaxPixelError() const { return m_MaxPixelError; }
 	
 	// 功能函数
 protected:
-	// 更新碰撞体
+	// 更新碰撞体, 使用设置的LOD
 	void UpdateBodySetup();
-	// 设置当前显示LOD
-	void SetLOD(int LODIndex);
+	// 碰撞使用的LOD, 没有模型时返回 INDEX_NONE
+	int32 GetCollisionLOD() const;
+	// 重新划分碰撞分块
+	void RebuildCollisionChunks();
+	// 测量每层LOD与第0层的几何偏差
+	void MeasureGeometricErrors();
+	// 自动生成的LOD完成 (游戏线程)
+	void OnMeshLODsBuilt(uint32 BuildSerial, TArray<FDTLODMeshBuildResult> && ArrayResult);
 
 public:
+	// 设置异步生成碰撞体, 生成期间继续使用旧碰撞体
+	void SetAsyncCooking(bool bAsyncCooking) { m_Collision.bAsyncCooking = bAsyncCooking; }
+	// 设置碰撞分块边长, 小于等于 0 时整体生成
+	void SetCollisionChunkSize(double ChunkSize) { m_Collision.ChunkSize = ChunkSize; }
+	// 设置碰撞数据来源, 渲染和简化来源使用 LODIndex 层, 超出时使用最后一层, AddFinish 时生成
+	void SetCollisionSource(EDTMeshCollisionSource Source, int32 LODIndex = 0, double DecimateSize = 0.0);
+	// 设置LOD允许的最大屏幕误差(像素), 按几何偏差选择LOD, 小于等于 0 时使用显示距离
+	void SetMaxPixelError(float MaxPixelError);
 	// 清空模型
 	void ClearMesh();
 	// 添加模型
 	int AddMeshLOD(const TArray<FVector>& Vertices, const TArray<int32>& Triangles, const TArray<FVector>& Normals, const TArray<FVector2D>& UVs, int64 DisplaysDistances);
 	// 添加完成
 	void AddFinish();
+	// 清空模型并使用第0层自动生成LOD, 第0层立即显示, 其他层在工作线程简化后添加
+	// bPreserveBorders 为真时边界保持不变, 地块拼接处在不同LOD之间没有裂缝
+	void BuildMeshLODs(const TArray<FVector>& Vertices, const TArray<int32>& Triangles, const TArray<FVector>& Normals, const TArray<FVector2D>& UVs, int64 DisplaysDistances, const TArray<FDTLODMeshBuildLevel>& Levels, bool bPreserveBorders = true);
 };
@@ -0,0 +1,413 @@
+﻿// Copyright 2024 Dexter.Wan. All Rights Reserved. 
+// EMail: 45141961@qq.com
+// Website: https://dt.cq.cn
+
+#include "DTMeshCollision.h"
+#include "Async/ParallelFor.h"
+#include "Components/PrimitiveComponent.h"
+#include "PhysicsEngine/BodySetup.h"
+
+UE_DISABLE_OPTIMIZATION_SHIP
+
+// 获取当前碰撞体
+UBodySetup* FDTMeshCollision::GetBodySetup(UPrimitiveComponent* Owner)
+{
+	if ( BodySetup == nullptr )
+	{
+		BodySetup = CreateBodySetup(Owner);
+	}
+	return BodySetup;
+}
+
+// 是否有正在异步生成的碰撞体
+bool FDTMeshCollision::IsCooking() const
+{
+	if ( ArrayCooking.Num() > 0 )
+	{
+		return true;
+	}
+	for ( const TObjectPtr<UBodySetup> & ChunkCooking : ArrayChunkCooking )
+	{
+		if ( ChunkCooking != nullptr )
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// 清空分块, 正在生成的分块完成后会被忽略
+void FDTMeshCollision::ResetChunks()
+{
+	for ( const TObjectPtr<UBodySetup> & ChunkCooking : ArrayChunkCooking )
+	{
+		if ( ChunkCooking != nullptr )
+		{
+			ArrayStaleCooking.Add(ChunkCooking);
+		}
+	}
+	ArrayChunk.Empty();
+	ArrayChunkBodySetup.Empty();
+	ArrayChunkCooking.Empty();
+	MapChunk.Empty();
+}
+
+// 添加三角形到分块
+void FDTMeshCollision::AddChunkTriangle(const FIntPoint& Triangle, const FVector3f& Center)
+{
+	if ( !IsChunked() )
+	{
+		return;
+	}
+
+	const FIntPoint Cell( FMath::FloorToInt32(Center.X / ChunkSize), FMath::FloorToInt32(Center.Y / ChunkSize) );
+	int32 & ChunkIndex = MapChunk.FindOrAdd(Cell, INDEX_NONE);
+	if ( ChunkIndex == INDEX_NONE )
+	{
+		ChunkIndex = ArrayChunk.Num();
+		FDTMeshCollisionChunk & Chunk = ArrayChunk.AddDefaulted_GetRef();
+		Chunk.Box = FBox(ForceInit);
+		Chunk.bDirty = true;
+		ArrayChunkBodySetup.Add(nullptr);
+		ArrayChunkCooking.Add(nullptr);
+	}
+	ArrayChunk[ChunkIndex].Triangles.Add(Triangle);
+}
+
+// 清空代理模型
+void FDTMeshCollision::ResetProxy()
+{
+	ProxyPositions.Empty();
+	ProxyTriangles.Empty();
+	ProxyMaterialIndices.Empty();
+}
+
+// 添加简化后的模型, 同一格子内的点合并为平均位置, 退化的三角形移除
+void FDTMeshCollision::AppendDecimated(TConstArrayView<FVector3f> Positions, TConstArrayView<FUintVector> Triangles, uint16 MaterialIndex)
+{
+	const uint32 VertexBase = ProxyPositions.Num();
+	ProxyTriangles.Reserve(ProxyTriangles.Num() + Triangles.Num());
+	ProxyMaterialIndices.Reserve(ProxyMaterialIndices.Num() + Triangles.Num());
+
+	// 不简化
+	if ( DecimateSize <= 0.0 )
+	{
+		ProxyPositions.Append(Positions.GetData(), Positions.Num());
+		for ( const FUintVector & Triangle : Triangles )
+		{
+			ProxyTriangles.Add( FUintVector(Triangle.X + VertexBase, Triangle.Y + VertexBase, Triangle.Z + VertexBase) );
+			ProxyMaterialIndices.Add(MaterialIndex);
+		}
+		return;
+	}
+
+	// 点按格子合并
+	TArray<uint32> ArrayRemap;
+	ArrayRemap.SetNumUninitialized(Positions.Num());
+	TMap<FIntVector, int32> MapCell;
+	TArray<FVector> ArraySum;
+	TArray<int32> ArrayCount;
+	for ( int32 Index = 0; Index < Positions.Num(); ++Index )
+	{
+		const FVector Position(Positions[Index]);
+		const FIntVector Cell( FMath::FloorToInt32(Position.X / DecimateSize), FMath::FloorToInt32(Position.Y / DecimateSize), FMath::FloorToInt32(Position.Z / DecimateSize) );
+		int32 & ClusterIndex = MapCell.FindOrAdd(Cell, INDEX_NONE);
+		if ( ClusterIndex == INDEX_NONE )
+		{
+			ClusterIndex = ArraySum.Add(FVector::ZeroVector);
+			ArrayCount.Add(0);
+		}
+		ArraySum[ClusterIndex] += Position;
+		++ArrayCount[ClusterIndex];
+		ArrayRemap[Index] = VertexBase + ClusterIndex;
+	}
+	ProxyPositions.Reserve(VertexBase + ArraySum.Num());
+	for ( int32 ClusterIndex = 0; ClusterIndex < ArraySum.Num(); ++ClusterIndex )
+	{
+		ProxyPositions.Add( FVector3f(ArraySum[ClusterIndex] / ArrayCount[ClusterIndex]) );
+	}
+
+	// 重新映射三角形
+	for ( const FUintVector & Triangle : Triangles )
+	{
+		const FUintVector NewTriangle(ArrayRemap[Triangle.X], ArrayRemap[Triangle.Y], ArrayRemap[Triangle.Z]);
+		if ( NewTriangle.X != NewTriangle.Y && NewTriangle.Y != NewTriangle.Z && NewTriangle.X != NewTriangle.Z )
+		{
+			ProxyTriangles.Add(NewTriangle);
+			ProxyMaterialIndices.Add(MaterialIndex);
+		}
+	}
+}
+
+// 设置规则网格代理模型
+void FDTMeshCollision::SetLattice(TConstArrayView<FVector> Points, TConstArrayView<int32> Triangles)
+{
+	ResetProxy();
+	ProxyPositions.SetNumUninitialized(Points.Num());
+	for ( int32 Index = 0; Index < Points.Num(); ++Index )
+	{
+		ProxyPositions[Index] = FVector3f(Points[Index]);
+	}
+	ProxyTriangles.Reserve(Triangles.Num() / 3);
+	for ( int32 Index = 0; Index + 2 < Triangles.Num(); Index += 3 )
+	{
+		ProxyTriangles.Add( FUintVector(Triangles[Index], Triangles[Index + 1], Triangles[Index + 2]) );
+	}
+	ProxyMaterialIndices.SetNumZeroed(ProxyTriangles.Num());
+}
+
+// 导出代理模型
+void FDTMeshCollision::ExportProxy(FTriMeshCollisionData* CollisionData) const
+{
+	AllocateTriMeshData(CollisionData, ProxyPositions.Num(), ProxyTriangles.Num(), false);
+	CopyVertices(CollisionData, 0, ProxyPositions);
+	CopyTriangles(CollisionData, 0, 0, ProxyTriangles, 0);
+	FMemory::Memcpy(CollisionData->MaterialIndices.GetData(), ProxyMaterialIndices.GetData(), ProxyMaterialIndices.Num() * sizeof(uint16));
+}
+
+// 标记可能包含该点的分块, 分块范围在上次导出时计算, 包含分块内所有点
+void FDTMeshCollision::MarkDirty(const FVector3f& Position)
+{
+	const FVector Point(Position);
+	for ( FDTMeshCollisionChunk & Chunk : ArrayChunk )
+	{
+		if ( !Chunk.bDirty && Chunk.Box.IsValid && Chunk.Box.IsInsideOrOn(Point) )
+		{
+			Chunk.bDirty = true;
+		}
+	}
+}
+
+// 按总数一次分配碰撞数据
+void FDTMeshCollision::AllocateTriMeshData(FTriMeshCollisionData* CollisionData, int32 NumVertices, int32 NumTriangles, bool bCopyUVs)
+{
+	CollisionData->Vertices.SetNumUninitialized(NumVertices);
+	CollisionData->Indices.SetNumUninitialized(NumTriangles);
+	CollisionData->MaterialIndices.SetNumUninitialized(NumTriangles);
+	if ( bCopyUVs )
+	{
+		// 先只设置一层UV
+		CollisionData->UVs.SetNum(1);
+		CollisionData->UVs[0].SetNumUninitialized(NumVertices);
+	}
+}
+
+// 批量复制点
+void FDTMeshCollision::CopyVertices(FTriMeshCollisionData* CollisionData, int32 VertexBase, TConstArrayView<FVector3f> Positions)
+{
+	check( VertexBase + Positions.Num() <= CollisionData->Vertices.Num() );
+	FMemory::Memcpy(CollisionData->Vertices.GetData() + VertexBase, Positions.GetData(), Positions.Num() * sizeof(FVector3f));
+}
+
+// 批量复制三角形
+void FDTMeshCollision::CopyTriangles(FTriMeshCollisionData* CollisionData, int32 TriangleBase, int32 VertexBase, TConstArrayView<FUintVector> Triangles, uint16 MaterialIndex)
+{
+	static_assert( sizeof(FTriIndices) == sizeof(FUintVector), "FTriIndices and FUintVector must have the same layout" );
+	check( TriangleBase + Triangles.Num() <= CollisionData->Indices.Num() );
+
+	FTriIndices * OutIndices = CollisionData->Indices.GetData() + TriangleBase;
+	if ( VertexBase == 0 )
+	{
+		FMemory::Memcpy(OutIndices, Triangles.GetData(), Triangles.Num() * sizeof(FTriIndices));
+	}
+	else
+	{
+		ParallelFor(Triangles.Num(), [&](int32 Index)
+		{
+			const FUintVector & Triangle = Triangles[Index];
+			OutIndices[Index].v0 = Triangle.X + VertexBase;
+			OutIndices[Index].v1 = Triangle.Y + VertexBase;
+			OutIndices[Index].v2 = Triangle.Z + VertexBase;
+		});
+	}
+
+	uint16 * OutMaterialIndices = CollisionData->MaterialIndices.GetData() + TriangleBase;
+	for ( int32 Index = 0; Index < Triangles.Num(); ++Index )
+	{
+		OutMaterialIndices[Index] = MaterialIndex;
+	}
+}
+
+// 生成碰撞体
+void FDTMeshCollision::Cook(UPrimitiveComponent* Owner, bool bFull)
+{
+	// 不生成碰撞, 清空碰撞体
+	if ( Source == EDTMeshCollisionSource::None )
+	{
+		Clear(Owner);
+		return;
+	}
+
+	// 整体生成
+	if ( !IsChunked() )
+	{
+		UBodySetup * NewBodySetup = CreateBodySetup(Owner);
+		ExportChunk = INDEX_NONE;
+		if ( bAsyncCooking )
+		{
+			// 数据在调用时导出, 生成在后台线程, 完成前继续使用旧碰撞体
+			ArrayCooking.Add(NewBodySetup);
+			NewBodySetup->CreatePhysicsMeshesAsync(FOnAsyncPhysicsCookFinished::CreateWeakLambda(Owner, [this, Owner, NewBodySetup](bool bSuccess)
+			{
+				OnCookFinished(Owner, bSuccess, NewBodySetup);
+			}));
+		}
+		else
+		{
+			NewBodySetup->CreatePhysicsMeshes();
+			BodySetup = NewBodySetup;
+			ArrayStaleCooking.Append(ArrayCooking);
+			ArrayCooking.Empty();
+			Owner->RecreatePhysicsState();
+		}
+		return;
+	}
+
+	// 分块生成
+	bool bCookChunk = false;
+	for ( int32 ChunkIndex = 0; ChunkIndex < ArrayChunk.Num(); ++ChunkIndex )
+	{
+		if ( bFull || ArrayChunk[ChunkIndex].bDirty )
+		{
+			CookChunk(Owner, ChunkIndex);
+			bCookChunk = true;
+		}
+	}
+	if ( (bFull || bCookChunk) && !IsCooking() )
+	{
+		AssembleChunks(Owner);
+	}
+}
+
+// 清空碰撞体, 正在生成的碰撞体完成后会被忽略
+void FDTMeshCollision::Clear(UPrimitiveComponent* Owner)
+{
+	ArrayStaleCooking.Append(ArrayCooking);
+	ArrayCooking.Empty();
+	ResetChunks();
+	ResetProxy();
+	if ( BodySetup != nullptr )
+	{
+		BodySetup->InvalidatePhysicsData();
+		Owner->RecreatePhysicsState();
+	}
+}
+
+// 创建碰撞体, 外部对象是组件, 生成时从组件导出数据
+UBodySetup* FDTMeshCollision::CreateBodySetup(UPrimitiveComponent* Owner)
+{
+	UBodySetup * NewBodySetup = NewObject<UBodySetup>(Owner, NAME_None, (Owner->IsTemplate() ? RF_Public | RF_ArchetypeObject : RF_NoFlags));
+	NewBodySetup->BodySetupGuid = FGuid::NewGuid();
+	NewBodySetup->bGenerateMirroredCollision = false;
+	NewBodySetup->bDoubleSidedGeometry = true;
+	NewBodySetup->CollisionTraceFlag = CTF_UseComplexAsSimple;
+	return NewBodySetup;
+}
+
+// 生成分块碰撞体
+void FDTMeshCollision::CookChunk(UPrimitiveComponent* Owner, int32 ChunkIndex)
+{
+	UBodySetup * NewBodySetup = CreateBodySetup(Owner);
+	ArrayChunk[ChunkIndex].bDirty = false;
+
+	// 分块上一次生成还没完成时结果作废
+	if ( ArrayChunkCooking[ChunkIndex] != nullptr )
+	{
+		ArrayStaleCooking.Add(ArrayChunkCooking[ChunkIndex]);
+		ArrayChunkCooking[ChunkIndex] = nullptr;
+	}
+
+	// 导出时组件只返回该分块的三角形
+	ExportChunk = ChunkIndex;
+	if ( bAsyncCooking )
+	{
+		ArrayChunkCooking[ChunkIndex] = NewBodySetup;
+		NewBodySetup->CreatePhysicsMeshesAsync(FOnAsyncPhysicsCookFinished::CreateWeakLambda(Owner, [this, Owner, NewBodySetup, ChunkIndex](bool bSuccess)
+		{
+			OnChunkCookFinished(Owner, bSuccess, NewBodySetup, ChunkIndex);
+		}));
+	}
+	else
+	{
+		NewBodySetup->CreatePhysicsMeshes();
+		ArrayChunkBodySetup[ChunkIndex] = NewBodySetup;
+	}
+	ExportChunk = INDEX_NONE;
+}
+
+// 整体碰撞体生成完成
+void FDTMeshCollision::OnCookFinished(UPrimitiveComponent* Owner, bool bSuccess, UBodySetup* FinishedBodySetup)
+{
+	const int32 CookingIndex = ArrayCooking.Find(FinishedBodySetup);
+	if ( CookingIndex == INDEX_NONE )
+	{
+		RemoveStaleCooking(FinishedBodySetup);
+		return;
+	}
+
+	if ( bSuccess )
+	{
+		// 更早开始的生成已经过时, 完成后再释放
+		BodySetup = FinishedBodySetup;
+		for ( int32 Index = 0; Index < CookingIndex; ++Index )
+		{
+			ArrayStaleCooking.Add(ArrayCooking[Index]);
+		}
+		ArrayCooking.RemoveAt(0, CookingIndex + 1);
+		Owner->RecreatePhysicsState();
+	}
+	else
+	{
+		ArrayCooking.RemoveAt(CookingIndex);
+	}
+}
+
+// 分块碰撞体生成完成
+void FDTMeshCollision::OnChunkCookFinished(UPrimitiveComponent* Owner, bool bSuccess, UBodySetup* FinishedBodySetup, int32 ChunkIndex)
+{
+	// 分块已经重新划分或者有更新的生成
+	if ( !ArrayChunkCooking.IsValidIndex(ChunkIndex) || ArrayChunkCooking[ChunkIndex] != FinishedBodySetup )
+	{
+		RemoveStaleCooking(FinishedBodySetup);
+		return;
+	}
+
+	ArrayChunkCooking[ChunkIndex] = nullptr;
+	if ( bSuccess )
+	{
+		ArrayChunkBodySetup[ChunkIndex] = FinishedBodySetup;
+	}
+	else
+	{
+		ArrayChunk[ChunkIndex].bDirty = true;
+	}
+
+	// 所有分块完成后一次替换, 避免中间状态
+	if ( !IsCooking() )
+	{
+		AssembleChunks(Owner);
+	}
+}
+
+// 合并分块碰撞体, 新碰撞体只引用分块已生成的三角网格, 不重新生成
+void FDTMeshCollision::AssembleChunks(UPrimitiveComponent* Owner)
+{
+	UBodySetup * NewBodySetup = CreateBodySetup(Owner);
+	for ( const TObjectPtr<UBodySetup> & ChunkBodySetup : ArrayChunkBodySetup )
+	{
+		if ( ChunkBodySetup == nullptr )
+		{
+			continue;
+		}
+#if ENGINE_MAJOR_VERSION >= 5 && ENGINE_MINOR_VERSION >= 4
+		NewBodySetup->TriMeshGeometries.Append(ChunkBodySetup->TriMeshGeometries);
+#else
+		NewBodySetup->ChaosTriMeshes.Append(ChunkBodySetup->ChaosTriMeshes);
+#endif
+	}
+	NewBodySetup->bCreatedPhysicsMeshes = true;
+	BodySetup = NewBodySetup;
+	Owner->RecreatePhysicsState();
+}
+
+UE_ENABLE_OPTIMIZATION_SHIP
@@ -0,0 +1,152 @@
+﻿// Copyright 2024 Dexter.Wan. All Rights Reserved. 
+// EMail: 45141961@qq.com
+// Website: https://dt.cq.cn
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Interface_CollisionDataProviderCore.h"
+#include "DTMeshCollision.generated.h"
+
+class UBodySetup;
+class UPrimitiveComponent;
+
+// 碰撞数据来源
+enum class EDTMeshCollisionSource : uint8
+{
+	None			= 0,					// 不生成碰撞
+	Render			= 1,					// 渲染模型, LOD 组件使用指定的LOD
+	Decimated		= 2,					// 渲染模型按格子合并点后的简化副本
+	Lattice			= 3,					// 外部提供的规则网格, 地形直接由格点生成
+};
+
+// 碰撞分块
+struct FDTMeshCollisionChunk
+{
+	FBox											Box;					// 分块内三角形的范围, 导出时更新
+	TArray<FIntPoint>								Triangles;				// 三角形, X 部件索引, Y 三角形索引
+	bool											bDirty;					// 需要重新生成
+};
+
+// 模型碰撞体, 支持异步生成和按空间分块生成
+// 异步生成时旧碰撞体一直使用到新碰撞体生成完成, 分块时只重新生成修改过的分块, 再合并为一个碰撞体
+USTRUCT()
+struct DTMODEL_API FDTMeshCollision
+{
+	GENERATED_BODY()
+
+public:
+	bool											bAsyncCooking = true;			// 异步生成
+	double											ChunkSize = 0.0;				// 分块边长, 小于等于 0 时不分块, 只对渲染模型来源有效
+	EDTMeshCollisionSource							Source = EDTMeshCollisionSource::Render;	// 数据来源
+	int32											SourceLOD = 0;					// 渲染模型来源使用的LOD
+	double											DecimateSize = 0.0;				// 简化时合并点的格子边长
+	TArray<FVector3f>								ProxyPositions;					// 简化或规则网格的点
+	TArray<FUintVector>								ProxyTriangles;					// 简化或规则网格的三角形
+	TArray<uint16>									ProxyMaterialIndices;			// 简化或规则网格的材质索引
+	int32											ExportChunk = INDEX_NONE;		// 正在导出的分块, 导出整体时为 INDEX_NONE
+	TArray<FDTMeshCollisionChunk>					ArrayChunk;						// 分块
+
+private:
+	UPROPERTY(Transient)
+	TObjectPtr<UBodySetup>							BodySetup;						// 当前使用的碰撞体
+	UPROPERTY(Transient)
+	TArray<TObjectPtr<UBodySetup>>					ArrayCooking;					// 正在异步生成的整体碰撞体, 按开始顺序
+	UPROPERTY(Transient)
+	TArray<TObjectPtr<UBodySetup>>					ArrayChunkBodySetup;			// 分块碰撞体
+	UPROPERTY(Transient)
+	TArray<TObjectPtr<UBodySetup>>					ArrayChunkCooking;				// 分块正在异步生成的碰撞体
+	UPROPERTY(Transient)
+	TArray<TObjectPtr<UBodySetup>>					ArrayStaleCooking;				// 已经过时但还在后台生成的碰撞体, 完成前保持引用
+	TMap<FIntPoint, int32>							MapChunk;						// 格子到分块索引
+
+public:
+	// 是否分块生成
+	bool IsChunked() const { return ChunkSize > 0.0 && Source == EDTMeshCollisionSource::Render; }
+	// 是否从代理模型导出
+	bool IsProxy() const { return Source == EDTMeshCollisionSource::Decimated || Source == EDTMeshCollisionSource::Lattice; }
+	// 获取当前碰撞体, 还没有生成时创建一个空的碰撞体
+	UBodySetup * GetBodySetup(UPrimitiveComponent * Owner);
+	// 是否有正在异步生成的碰撞体
+	bool IsCooking() const;
+
+	// 清空分块
+	void ResetChunks();
+	// 添加三角形到分块, 按三角形中心所在格子划分, Triangle X 部件索引, Y 三角形索引
+	void AddChunkTriangle(const FIntPoint & Triangle, const FVector3f & Center);
+	// 清空代理模型
+	void ResetProxy();
+	// 添加简化后的模型到代理模型, DecimateSize 小于等于 0 时直接复制
+	void AppendDecimated(TConstArrayView<FVector3f> Positions, TConstArrayView<FUintVector> Triangles, uint16 MaterialIndex);
+	// 设置规则网格代理模型, 三角形每 3 个索引一组
+	void SetLattice(TConstArrayView<FVector> Points, TConstArrayView<int32> Triangles);
+	// 导出代理模型
+	void ExportProxy(FTriMeshCollisionData * CollisionData) const;
+
+	// 点移动前调用, 标记可能包含该点的分块
+	void MarkDirty(const FVector3f & Position);
+
+	// 导出正在生成的分块, 点按部件重新编号, 同时更新分块范围
+	// GetTriangle(FIntPoint) 返回部件三角形, GetPosition(SectionIndex, VertexIndex) 返回点位置
+	template<typename GetTriangleType, typename GetPositionType>
+	void ExportChunkTriangles(FTriMeshCollisionData * CollisionData, GetTriangleType GetTriangle, GetPositionType GetPosition)
+	{
+		FDTMeshCollisionChunk & Chunk = ArrayChunk[ExportChunk];
+		Chunk.Box = FBox(ForceInit);
+		CollisionData->Indices.Reserve(Chunk.Triangles.Num());
+		CollisionData->MaterialIndices.Reserve(Chunk.Triangles.Num());
+
+		TMap<FIntPoint, int32> MapVertex;
+		MapVertex.Reserve(Chunk.Triangles.Num());
+		for ( const FIntPoint & ChunkTriangle : Chunk.Triangles )
+		{
+			const FUintVector SectionTriangle = GetTriangle(ChunkTriangle);
+			int32 Indices[3];
+			for ( int32 Corner = 0; Corner < 3; ++Corner )
+			{
+				const int32 VertexIndex = SectionTriangle[Corner];
+				int32 & Index = MapVertex.FindOrAdd(FIntPoint(ChunkTriangle.X, VertexIndex), INDEX_NONE);
+				if ( Index == INDEX_NONE )
+				{
+					const FVector3f Position = GetPosition(ChunkTriangle.X, VertexIndex);
+					Index = CollisionData->Vertices.Add(Position);
+					Chunk.Box += FVector(Position);
+				}
+				Indices[Corner] = Index;
+			}
+
+			FTriIndices Triangle;
+			Triangle.v0 = Indices[0];
+			Triangle.v1 = Indices[1];
+			Triangle.v2 = Indices[2];
+			CollisionData->Indices.Add(Triangle);
+			CollisionData->MaterialIndices.Add(ChunkTriangle.X);
+		}
+	}
+
+	// 按总数一次分配碰撞数据, bCopyUVs 时同时分配一层UV
+	static void AllocateTriMeshData(FTriMeshCollisionData * CollisionData, int32 NumVertices, int32 NumTriangles, bool bCopyUVs);
+	// 批量复制点到 VertexBase 开始的位置
+	static void CopyVertices(FTriMeshCollisionData * CollisionData, int32 VertexBase, TConstArrayView<FVector3f> Positions);
+	// 批量复制三角形到 TriangleBase 开始的位置, 点索引加 VertexBase, 没有偏移时直接复制内存
+	static void CopyTriangles(FTriMeshCollisionData * CollisionData, int32 TriangleBase, int32 VertexBase, TConstArrayView<FUintVector> Triangles, uint16 MaterialIndex);
+
+	// 清空碰撞体, 保留碰撞体对象重复使用
+	void Clear(UPrimitiveComponent * Owner);
+	// 生成碰撞体, 分块时 bFull 为 false 只生成标记的分块, 来源为 None 时移除碰撞体
+	void Cook(UPrimitiveComponent * Owner, bool bFull);
+
+private:
+	// 创建碰撞体
+	static UBodySetup * CreateBodySetup(UPrimitiveComponent * Owner);
+	// 生成分块碰撞体
+	void CookChunk(UPrimitiveComponent * Owner, int32 ChunkIndex);
+	// 整体碰撞体生成完成
+	void OnCookFinished(UPrimitiveComponent * Owner, bool bSuccess, UBodySetup * FinishedBodySetup);
+	// 移除过时的碰撞体, 不在过时列表中时返回 false
+	bool RemoveStaleCooking(UBodySetup * FinishedBodySetup) { return ArrayStaleCooking.RemoveSingleSwap(FinishedBodySetup) > 0; }
+	// 分块碰撞体生成完成
+	void OnChunkCookFinished(UPrimitiveComponent * Owner, bool bSuccess, UBodySetup * FinishedBodySetup, int32 ChunkIndex);
+	// 合并分块碰撞体并替换当前碰撞体
+	void AssembleChunks(UPrimitiveComponent * Owner);
+};
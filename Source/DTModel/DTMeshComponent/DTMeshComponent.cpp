@@ -6,6 +6,7 @@
 #include "DTMeshComponent.h"
 
 #include "MaterialDomain.h"
+#include "Async/ParallelFor.h"
 #include "Materials/MaterialRenderProxy.h"
 #include "Physics/Experimental/PhysScene_Chaos.h"
 #include "PhysicsEngine/BodySetup.h"
@@ -13,38 +14,111 @@
 
 UE_DISABLE_OPTIMIZATION_SHIP
 
+static constexpr uint64 DTMeshEditDynamicFrames = 30;							// 顶点编辑后保持动态绘画的帧数
+static constexpr int32 DTMeshEditMergeGap = 64;									// 相隔不超过该点数的修改区间合并上传
+static constexpr double DTMeshCollisionInterval = 0.25;							// 编辑时碰撞体重新生成的最小间隔(秒)
+
+// 顶点上传区间
+struct FDTMeshVertexRange
+{
+	int32											Begin;					// 起始点
+	int32											Count;					// 点数量
+};
+
+// --------------------------------------------------------------------------
+// 共享GPU数据 析构函数
+FDTMeshSectionGPU::~FDTMeshSectionGPU()
+{
+	VertexBuffers.PositionVertexBuffer.ReleaseResource();
+	VertexBuffers.StaticMeshVertexBuffer.ReleaseResource();
+	VertexBuffers.ColorVertexBuffer.ReleaseResource();
+	VertexFactory.ReleaseResource();
+	IndexBuffer.ReleaseResource();
+}
+
+// 创建共享数据, 删除放到渲染线程, 不会和使用中的渲染资源冲突
+FDTMeshSectionGPUPtr FDTMeshSectionGPU::Create(ERHIFeatureLevel::Type InFeatureLevel)
+{
+	return FDTMeshSectionGPUPtr(new FDTMeshSectionGPU(InFeatureLevel), [](FDTMeshSectionGPU * MeshSectionGPU)
+	{
+		ENQUEUE_RENDER_COMMAND(DeleteDTMeshSectionGPU)([MeshSectionGPU](FRHICommandListImmediate& RHICmdList)
+		{
+			delete MeshSectionGPU;
+		});
+	});
+}
+
+// 创建渲染资源
+void FDTMeshSectionGPU::InitResources(FRHICommandListBase& RHICmdList)
+{
+	check(IsInRenderingThread());
+	if ( VertexFactory.IsInitialized() )
+	{
+		return;
+	}
+
+	// 顶点缓冲初始化时设置了不需要CPU访问, 上传后自动释放
+	VertexBuffers.PositionVertexBuffer.InitResource(RHICmdList);
+	VertexBuffers.StaticMeshVertexBuffer.InitResource(RHICmdList);
+	VertexBuffers.ColorVertexBuffer.InitResource(RHICmdList);
+	IndexBuffer.InitResource(RHICmdList);
+
+	// 索引缓冲上传时复制, 这里释放
+	IndexBuffer.Indices.Empty();
+
+	FLocalVertexFactory::FDataType Data;
+	VertexBuffers.PositionVertexBuffer.BindPositionVertexBuffer(&VertexFactory, Data);
+	VertexBuffers.StaticMeshVertexBuffer.BindTangentVertexBuffer(&VertexFactory, Data);
+	VertexBuffers.StaticMeshVertexBuffer.BindPackedTexCoordVertexBuffer(&VertexFactory, Data);
+	VertexBuffers.StaticMeshVertexBuffer.BindLightMapVertexBuffer(&VertexFactory, Data, 0);
+	VertexBuffers.ColorVertexBuffer.BindColorVertexBuffer(&VertexFactory, Data);
+	VertexFactory.SetData(RHICmdList, Data);
+	VertexFactory.InitResource(RHICmdList);
+}
+
+// 顶点被编辑, 之后一段时间使用动态绘画
+void FDTMeshSectionGPU::NotifyVertexEdited()
+{
+	check(IsInRenderingThread());
+	EditEndFrame = GFrameCounterRenderThread + DTMeshEditDynamicFrames;
+}
+
 // --------------------------------------------------------------------------
-// 模型代理 构造函数
+// 模型代理 构造函数, 只引用组件构建好的GPU数据, 不复制顶点
 FDTMeshSceneProxy::FDTMeshSceneProxy(UDTMeshComponent* DTMeshComponent)
 	: FPrimitiveSceneProxy(DTMeshComponent)
 	, m_MaterialRelevance(DTMeshComponent->GetMaterialRelevance(GetScene().GetFeatureLevel()))
+	, m_bStaticDraw(DTMeshComponent->IsStaticDraw())
 {
 	TArray<FDTMeshSectionCPU> & MeshSectionsCPU = DTMeshComponent->GetMeshSections();
 	for ( int Index = 0; Index < MeshSectionsCPU.Num(); ++Index )
 	{
-		FDTMeshSectionCPU & MeshSectionCPU = MeshSectionsCPU[Index];
-		FDTMeshSectionGPU * MeshSectionGPU = new FDTMeshSectionGPU(DTMeshComponent->GetMaterial(Index), GetScene().GetFeatureLevel());
-		MeshSectionGPU->VertexBuffers.InitFromDynamicVertex(&MeshSectionGPU->VertexFactory, MeshSectionCPU.Vertices);
-		MeshSectionGPU->IndexBuffer.Indices.Append( (uint32*)MeshSectionCPU.Triangles.GetData(), MeshSectionCPU.Triangles.Num() * 3 );
-		m_MeshSections.Add(MeshSectionGPU);
+		UMaterialInterface * MaterialInterface = DTMeshComponent->GetMaterial(Index);
+		m_MeshSections.Add(MeshSectionsCPU[Index].GPU);
+		m_MaterialInterfaces.Add(MaterialInterface ? MaterialInterface : UMaterial::GetDefaultMaterial(MD_Surface));
 	}
-	
-	UE_LOG(LogTemp, Display, TEXT("FDTModelSceneProxy 线程ID : %d"), FPlatformTLS::GetCurrentThreadId());
 }
 
 FDTMeshSceneProxy::~FDTMeshSceneProxy()
 {
-	for (FDTMeshSectionGPU *& MeshSection : m_MeshSections)
+	m_MeshSections.Empty();
+}
+
+// 当前是否使用静态绘画, 编辑中和线框模式使用动态绘画
+bool FDTMeshSceneProxy::IsStaticDrawing(const FSceneView* View) const
+{
+	if ( !m_bStaticDraw )
 	{
-		MeshSection->VertexBuffers.PositionVertexBuffer.ReleaseResource();
-		MeshSection->VertexBuffers.StaticMeshVertexBuffer.ReleaseResource();
-		MeshSection->VertexBuffers.ColorVertexBuffer.ReleaseResource();
-		MeshSection->VertexFactory.ReleaseResource();
-		MeshSection->IndexBuffer.ReleaseResource();
-		delete MeshSection;
-		MeshSection = nullptr;
+		return false;
 	}
-	m_MeshSections.Empty();
+	for (const FDTMeshSectionGPUPtr & MeshSection : m_MeshSections)
+	{
+		if ( GFrameCounterRenderThread < MeshSection->EditEndFrame )
+		{
+			return false;
+		}
+	}
+	return !(AllowDebugViewmodes() && View->Family->EngineShowFlags.Wireframe);
 }
 
 // 返回Hash值
@@ -66,8 +140,9 @@ FPrimitiveViewRelevance FDTMeshSceneProxy::GetViewRelevance(const FSceneView* Vi
 	FPrimitiveViewRelevance Result;
 	Result.bDrawRelevance = IsShown(View);
 	Result.bShadowRelevance = IsShadowCast(View);
-	Result.bDynamicRelevance = true;
-	Result.bStaticRelevance = false;
+	const bool bStaticDrawing = IsStaticDrawing(View);
+	Result.bDynamicRelevance = !bStaticDrawing;
+	Result.bStaticRelevance = bStaticDrawing;
 	Result.bRenderInMainPass = ShouldRenderInMainPass();
 	Result.bUsesLightingChannels = GetLightingChannelMask() != GetDefaultLightingChannelMask();
 	Result.bRenderCustomDepth = ShouldRenderCustomDepth();
@@ -93,13 +168,46 @@ void FDTMeshSceneProxy::CreateRenderThreadResources()
 #if ENGINE_MAJOR_VERSION <= 5 && ENGINE_MINOR_VERSION <= 3
 	FRHICommandListBase& RHICmdList = FRHICommandListImmediate::Get();
 #endif
-	for (FDTMeshSectionGPU *& MeshSection : m_MeshSections)
+	for (const FDTMeshSectionGPUPtr & MeshSection : m_MeshSections)
+	{
+		MeshSection->InitResources(RHICmdList);
+	}
+}
+
+// 绘画静态模型, 绘画命令由渲染器缓存, 顶点缓冲原地更新后命令仍然有效
+void FDTMeshSceneProxy::DrawStaticElements(FStaticPrimitiveDrawInterface* PDI)
+{
+	if ( !m_bStaticDraw )
+	{
+		return;
+	}
+
+	for (int32 SectionIndex = 0; SectionIndex < m_MeshSections.Num(); ++SectionIndex)
 	{
-		MeshSection->VertexBuffers.StaticMeshVertexBuffer.InitResource(RHICmdList);
-		MeshSection->VertexBuffers.PositionVertexBuffer.InitResource(RHICmdList);
-		MeshSection->VertexBuffers.ColorVertexBuffer.InitResource(RHICmdList);
-		MeshSection->VertexFactory.InitResource(RHICmdList);
-		MeshSection->IndexBuffer.InitResource(RHICmdList);
+		const FDTMeshSectionGPU * MeshSection = m_MeshSections[SectionIndex].Get();
+		if ( MeshSection->NumIndices == 0 )
+		{
+			continue;
+		}
+
+		FMeshBatch Mesh;
+		FMeshBatchElement& BatchElement = Mesh.Elements[0];
+		Mesh.VertexFactory = &MeshSection->VertexFactory;
+		Mesh.MaterialRenderProxy = m_MaterialInterfaces[SectionIndex]->GetRenderProxy();
+		Mesh.ReverseCulling = IsLocalToWorldDeterminantNegative();
+		Mesh.Type = PT_TriangleList;
+		Mesh.DepthPriorityGroup = SDPG_World;
+		Mesh.LODIndex = 0;
+		Mesh.CastShadow = true;
+		Mesh.bCanApplyViewModeOverrides = false;
+
+		BatchElement.IndexBuffer = &MeshSection->IndexBuffer;
+		BatchElement.FirstIndex = 0;
+		BatchElement.NumPrimitives = MeshSection->NumIndices / 3;
+		BatchElement.MinVertexIndex = 0;
+		BatchElement.MaxVertexIndex = MeshSection->VertexBuffers.PositionVertexBuffer.GetNumVertices() - 1;
+
+		PDI->DrawMesh(Mesh, FLT_MAX);
 	}
 }
 
@@ -116,10 +224,12 @@ void FDTMeshSceneProxy::GetDynamicMeshElements(const TArray<const FSceneView*>&
 	}
 
 	// 遍历所有部件
-	for (const FDTMeshSectionGPU * MeshSection : m_MeshSections)
+	for (int32 SectionIndex = 0; SectionIndex < m_MeshSections.Num(); ++SectionIndex)
 	{
+		const FDTMeshSectionGPU * MeshSection = m_MeshSections[SectionIndex].Get();
+
 		// 获取材质绘画材质
-		FMaterialRenderProxy* MaterialProxy = bWireframe ? WireframeMaterialInstance : MeshSection->MaterialInterface->GetRenderProxy();
+		FMaterialRenderProxy* MaterialProxy = bWireframe ? WireframeMaterialInstance : m_MaterialInterfaces[SectionIndex]->GetRenderProxy();
 
 		// 遍历所有视图
 		for (int32 ViewIndex = 0; ViewIndex < Views.Num(); ViewIndex++)
@@ -150,7 +260,7 @@ void FDTMeshSceneProxy::GetDynamicMeshElements(const TArray<const FSceneView*>&
 				
 				BatchElement.IndexBuffer = &MeshSection->IndexBuffer;
 				BatchElement.FirstIndex = 0;
-				BatchElement.NumPrimitives = MeshSection->IndexBuffer.Indices.Num() / 3;
+				BatchElement.NumPrimitives = MeshSection->NumIndices / 3;
 				BatchElement.MinVertexIndex = 0;
 				BatchElement.MaxVertexIndex = MeshSection->VertexBuffers.PositionVertexBuffer.GetNumVertices() - 1;
 
@@ -165,8 +275,17 @@ void FDTMeshSceneProxy::GetDynamicMeshElements(const TArray<const FSceneView*>&
 UDTMeshComponent::UDTMeshComponent(const FObjectInitializer& ObjectInitializer)
 	: Super(ObjectInitializer)
 	, m_MeshSceneProxy( nullptr )
+	, m_bStaticDraw( true )
+	, m_bHalfPrecisionUV( false )
+	, m_bVertexDirty( false )
+	, m_bCollisionDirty( false )
+	, m_CollisionTime( 0.0 )
 	, m_LocalBounds( ForceInitToZero )
 {
+	// 只在有编辑时打开, 在其他组件更新之后提交
+	PrimaryComponentTick.bCanEverTick = true;
+	PrimaryComponentTick.bStartWithTickEnabled = false;
+	PrimaryComponentTick.TickGroup = TG_PostUpdateWork;
 }
 
 // 开始播放
@@ -175,10 +294,34 @@ void UDTMeshComponent::BeginPlay()
 	Super::BeginPlay();
 }
 
+// 帧末提交顶点编辑
+void UDTMeshComponent::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
+{
+	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+
+	FlushVertexEdits();
+
+	// 碰撞体还在等待时继续检查
+	if ( !m_bVertexDirty && !m_bCollisionDirty )
+	{
+		SetComponentTickEnabled(false);
+	}
+}
+
 
 // 返回场景代理
 FPrimitiveSceneProxy* UDTMeshComponent::CreateSceneProxy()
 {
+	// 特性等级变化时重新构建GPU数据
+	const ERHIFeatureLevel::Type FeatureLevel = GetScene()->GetFeatureLevel();
+	for (FDTMeshSectionCPU & MeshSection : m_MeshSections)
+	{
+		if ( !MeshSection.GPU.IsValid() || MeshSection.GPU->FeatureLevel != FeatureLevel )
+		{
+			BuildSectionGPU(MeshSection, FeatureLevel);
+		}
+	}
+
 	m_MeshSceneProxy = new FDTMeshSceneProxy(this);
 	return m_MeshSceneProxy;
 }
@@ -186,15 +329,7 @@ FPrimitiveSceneProxy* UDTMeshComponent::CreateSceneProxy()
 // 碰撞代理
 UBodySetup* UDTMeshComponent::GetBodySetup()
 {
-	if ( m_BodySetup == nullptr )
-	{
-		m_BodySetup = NewObject<UBodySetup>(this, NAME_None, (IsTemplate() ? RF_Public | RF_ArchetypeObject : RF_NoFlags));
-		m_BodySetup->BodySetupGuid = FGuid::NewGuid();
-		m_BodySetup->bGenerateMirroredCollision = false;
-		m_BodySetup->bDoubleSidedGeometry = true;
-		m_BodySetup->CollisionTraceFlag = CTF_UseComplexAsSimple;
-	}
-	return m_BodySetup;
+	return m_Collision.GetBodySetup(this);
 }
 
 // 返回场景大小
@@ -217,7 +352,7 @@ bool UDTMeshComponent::GetTriMeshSizeEstimates(FTriMeshCollisionDataEstimates& O
 {
 	for (const FDTMeshSectionCPU& MeshSection : m_MeshSections)
 	{
-		OutTriMeshEstimates.VerticeCount += MeshSection.Vertices.Num();
+		OutTriMeshEstimates.VerticeCount += MeshSection.NumVertices();
 	}
 	return true;
 }
@@ -225,48 +360,66 @@ bool UDTMeshComponent::GetTriMeshSizeEstimates(FTriMeshCollisionDataEstimates& O
 // 返回碰撞数据
 bool UDTMeshComponent::GetPhysicsTriMeshData(FTriMeshCollisionData* CollisionData, bool InUseAllTriData)
 {
+	// 简化模型
+	if ( m_Collision.IsProxy() )
+	{
+		m_Collision.ExportProxy(CollisionData);
+		CollisionData->bFlipNormals = true;
+		CollisionData->bDeformableMesh = true;
+		CollisionData->bFastCook = true;
+		return true;
+	}
+
+	// 分块生成时只导出当前分块, 合并后的碰撞体没有UV
+	if ( m_Collision.ExportChunk != INDEX_NONE )
+	{
+		m_Collision.ExportChunkTriangles(CollisionData,
+			[this](const FIntPoint & Triangle) { return m_MeshSections[Triangle.X].Triangles[Triangle.Y]; },
+			[this](int32 SectionIndex, int32 VertexIndex) { return m_MeshSections[SectionIndex].Positions[VertexIndex]; });
+		CollisionData->bFlipNormals = true;
+		CollisionData->bDeformableMesh = true;
+		CollisionData->bFastCook = true;
+		return true;
+	}
+	
 	// UV碰撞体
-	bool bCopyUVs = UPhysicsSettings::Get()->bSupportUVFromHitResults; 
-	if ( bCopyUVs )
+	const bool bCopyUVs = UPhysicsSettings::Get()->bSupportUVFromHitResults; 
+
+	// 按总数一次分配
+	int32 NumVertices = 0;
+	int32 NumTriangles = 0;
+	for (const FDTMeshSectionCPU& MeshSection : m_MeshSections)
 	{
-		// 先只设置一层UV
-		CollisionData->UVs.AddZeroed(1); 
+		NumVertices += MeshSection.NumVertices();
+		NumTriangles += MeshSection.Triangles.Num();
 	}
+	FDTMeshCollision::AllocateTriMeshData(CollisionData, NumVertices, NumTriangles, bCopyUVs);
 	
-	// 遍历所有部件
+	// 遍历所有部件, 按偏移批量复制
 	int32 VertexBase = 0;
+	int32 TriangleBase = 0;
 	for (int32 SectionIndex = 0; SectionIndex < m_MeshSections.Num(); ++SectionIndex)
 	{
 		// 获取模型组件
-		FDTMeshSectionCPU & MeshSection = m_MeshSections[SectionIndex];
+		const FDTMeshSectionCPU & MeshSection = m_MeshSections[SectionIndex];
 
 		// 获取点数据
-		for (int32 VertIndex = 0; VertIndex < MeshSection.Vertices.Num(); VertIndex++)
+		FDTMeshCollision::CopyVertices(CollisionData, VertexBase, MeshSection.Positions);
+		if ( bCopyUVs )
 		{
-			CollisionData->Vertices.Add(MeshSection.Vertices[VertIndex].Position);
-			
-			if ( bCopyUVs )
+			FVector2D * OutUVs = CollisionData->UVs[0].GetData() + VertexBase;
+			ParallelFor(MeshSection.NumVertices(), [&](int32 VertIndex)
 			{
-				CollisionData->UVs[0].Add(FVector2D(MeshSection.Vertices[VertIndex].TextureCoordinate[0]));
-			}
+				OutUVs[VertIndex] = FVector2D(MeshSection.GetUV(VertIndex));
+			});
 		}
 
-		// 获取三角形数据
-		for (int32 TriIndex = 0; TriIndex < MeshSection.Triangles.Num(); TriIndex++)
-		{
-			// 保存偏移后三角形
-			FTriIndices Triangle;
-			Triangle.v0 = MeshSection.Triangles[TriIndex].X + VertexBase;
-			Triangle.v1 = MeshSection.Triangles[TriIndex].Y + VertexBase;
-			Triangle.v2 = MeshSection.Triangles[TriIndex].Z + VertexBase;
-			CollisionData->Indices.Add(Triangle);
-
-			// 保存材质索引
-			CollisionData->MaterialIndices.Add(SectionIndex);
-		}
+		// 获取三角形数据, 材质索引为部件索引
+		FDTMeshCollision::CopyTriangles(CollisionData, TriangleBase, VertexBase, MeshSection.Triangles, SectionIndex);
 
-		// 偏移顶点基点
-		VertexBase = CollisionData->Vertices.Num();
+		// 偏移基点
+		VertexBase += MeshSection.NumVertices();
+		TriangleBase += MeshSection.Triangles.Num();
 	}
 	
 	CollisionData->bFlipNormals = true;
@@ -279,16 +432,16 @@ bool UDTMeshComponent::GetPhysicsTriMeshData(FTriMeshCollisionData* CollisionDat
 // 返回碰撞支持
 bool UDTMeshComponent::ContainsPhysicsTriMeshData(bool InUseAllTriData) const
 {
-	return !!m_MeshSections.Num();
+	return m_Collision.Source != EDTMeshCollisionSource::None && !!m_MeshSections.Num();
 }
 
 // 获取BOX
-FBox UDTMeshComponent::GetBox(const TArray<FDynamicMeshVertex>& Vertices) const
+FBox UDTMeshComponent::GetBox(const TArray<FVector3f>& Positions) const
 {
 	FBox Box(EForceInit::ForceInit);
-	for ( const FDynamicMeshVertex & Vertex : Vertices )
+	for ( const FVector3f & Position : Positions )
 	{
-		Box += FVector( Vertex.Position.X, Vertex.Position.Y, Vertex.Position.Z );
+		Box += FVector( Position.X, Position.Y, Position.Z );
 	}
 	return Box;
 }
@@ -306,19 +459,136 @@ void UDTMeshComponent::UpdateLocalBounds()
 }
 
 // 更新碰撞体
-void UDTMeshComponent::UpdateBodySetup()
+void UDTMeshComponent::UpdateBodySetup(bool bFull)
+{
+	m_bCollisionDirty = false;
+	m_CollisionTime = FPlatformTime::Seconds();
+
+	// 简化模型每次从当前顶点重新生成
+	if ( m_Collision.Source == EDTMeshCollisionSource::Decimated )
+	{
+		m_Collision.ResetProxy();
+		for ( int32 SectionIndex = 0; SectionIndex < m_MeshSections.Num(); ++SectionIndex )
+		{
+			m_Collision.AppendDecimated(m_MeshSections[SectionIndex].Positions, m_MeshSections[SectionIndex].Triangles, SectionIndex);
+		}
+	}
+	m_Collision.Cook(this, bFull);
+}
+
+// 设置碰撞数据来源
+void UDTMeshComponent::SetCollisionSource(EDTMeshCollisionSource Source, double DecimateSize)
+{
+	// 规则网格只由地形提供
+	if ( Source == EDTMeshCollisionSource::Lattice )
+	{
+		return;
+	}
+	if ( m_Collision.Source != Source || m_Collision.DecimateSize != DecimateSize )
+	{
+		m_Collision.Source = Source;
+		m_Collision.DecimateSize = DecimateSize;
+		m_Collision.ResetProxy();
+		RebuildCollisionChunks();
+		if ( m_MeshSections.Num() )
+		{
+			UpdateBodySetup();
+		}
+	}
+}
+
+// 设置碰撞分块边长
+void UDTMeshComponent::SetCollisionChunkSize(double ChunkSize)
+{
+	if ( m_Collision.ChunkSize != ChunkSize )
+	{
+		m_Collision.ChunkSize = ChunkSize;
+		RebuildCollisionChunks();
+		if ( m_MeshSections.Num() )
+		{
+			UpdateBodySetup();
+		}
+	}
+}
+
+// 重新划分碰撞分块
+void UDTMeshComponent::RebuildCollisionChunks()
+{
+	m_Collision.ResetChunks();
+	if ( !m_Collision.IsChunked() )
+	{
+		return;
+	}
+	for ( int32 SectionIndex = 0; SectionIndex < m_MeshSections.Num(); ++SectionIndex )
+	{
+		const FDTMeshSectionCPU & MeshSection = m_MeshSections[SectionIndex];
+		for ( int32 TriIndex = 0; TriIndex < MeshSection.Triangles.Num(); ++TriIndex )
+		{
+			const FUintVector & Triangle = MeshSection.Triangles[TriIndex];
+			const FVector3f Center = (MeshSection.Positions[Triangle.X] + MeshSection.Positions[Triangle.Y] + MeshSection.Positions[Triangle.Z]) / 3.0f;
+			m_Collision.AddChunkTriangle(FIntPoint(SectionIndex, TriIndex), Center);
+		}
+	}
+}
+
+// 设置静态绘画
+void UDTMeshComponent::SetStaticDraw(bool bStaticDraw)
 {
-	if ( UBodySetup* BodySetup = GetBodySetup() )
+	if ( m_bStaticDraw != bStaticDraw )
+	{
+		m_bStaticDraw = bStaticDraw;
+		MarkRenderStateDirty();
+	}
+}
+
+// 构建GPU数据
+void UDTMeshComponent::BuildSectionGPU(FDTMeshSectionCPU& MeshSectionCPU, ERHIFeatureLevel::Type FeatureLevel) const
+{
+	FDTMeshSectionGPUPtr MeshSectionGPU = FDTMeshSectionGPU::Create(FeatureLevel);
+	FStaticMeshVertexBuffers & VertexBuffers = MeshSectionGPU->VertexBuffers;
+	const int32 VertexCount = MeshSectionCPU.NumVertices();
+	const bool bHalfPrecisionUV = MeshSectionCPU.IsHalfPrecisionUV();
+
+	// 位置
+	VertexBuffers.PositionVertexBuffer.Init(MeshSectionCPU.Positions, false);
+
+	// UV, 只有一层时按点连续保存, 格式一致直接复制
+	VertexBuffers.StaticMeshVertexBuffer.SetUseHighPrecisionTangentBasis(false);
+	VertexBuffers.StaticMeshVertexBuffer.SetUseFullPrecisionUVs(!bHalfPrecisionUV);
+	VertexBuffers.StaticMeshVertexBuffer.Init(VertexCount, 1, false);
+	if ( VertexCount > 0 )
+	{
+		const void * UVData = bHalfPrecisionUV ? static_cast<const void *>(MeshSectionCPU.HalfUVs.GetData()) : static_cast<const void *>(MeshSectionCPU.UVs.GetData());
+		FMemory::Memcpy(VertexBuffers.StaticMeshVertexBuffer.GetTexCoordData(), UVData, VertexCount * (bHalfPrecisionUV ? sizeof(FVector2DHalf) : sizeof(FVector2f)));
+	}
+
+	// 切线, TangentX 固定, TangentZ 为压缩法线, 每个点只写自己的位置, 可以并行
+	typedef TStaticMeshVertexTangentDatum<FPackedNormal> FTangentDatum;
+	FTangentDatum * TangentData = static_cast<FTangentDatum *>(VertexBuffers.StaticMeshVertexBuffer.GetTangentData());
+	const FPackedNormal TangentX(FVector3f::ForwardVector);
+	ParallelFor(VertexCount, [&](int32 Index)
+	{
+		TangentData[Index].TangentX = TangentX;
+		TangentData[Index].TangentZ = MeshSectionCPU.Normals[Index];
+	});
+
+	// 颜色, 没有颜色时不创建, 绑定默认白色缓冲
+	if ( MeshSectionCPU.Colors.Num() == VertexCount && VertexCount > 0 )
 	{
-		BodySetup->bHasCookedCollisionData = true;
-		BodySetup->InvalidatePhysicsData();
-		BodySetup->CreatePhysicsMeshes();
-		RecreatePhysicsState();
+		VertexBuffers.ColorVertexBuffer.InitFromColorArray(MeshSectionCPU.Colors, sizeof(FColor), false);
 	}
+
+	TArray<uint32> & Indices = MeshSectionGPU->IndexBuffer.Indices;
+	Indices.SetNumUninitialized(MeshSectionCPU.Triangles.Num() * 3);
+	FMemory::Memcpy(Indices.GetData(), MeshSectionCPU.Triangles.GetData(), Indices.Num() * sizeof(uint32));
+	MeshSectionGPU->NumIndices = Indices.Num();
+
+	// 替换后旧数据由仍在使用的场景代理持有, 最后在渲染线程删除
+	MeshSectionCPU.GPU = MeshSectionGPU;
 }
 
 // 创建模型点
-int UDTMeshComponent::AddMeshSection(const TArray<FVector>& Vertices, const TArray<int32>& Triangles, const TArray<FVector>& Normals, const TArray<FVector2D>& UVs)
+int UDTMeshComponent::AddMeshSection(const TArray<FVector>& Vertices, const TArray<int32>& Triangles, const TArray<FVector>& Normals, const TArray<FVector2D>& UVs, const TArray<FColor>& Colors)
 {
 	// 创建模型
 	FDTMeshSectionCPU & MeshSectionCPU = m_MeshSections.AddDefaulted_GetRef();
@@ -328,13 +598,33 @@ int UDTMeshComponent::AddMeshSection(const TArray<FVector>& Vertices, const TArr
 	const int32 VertexCount = Vertices.Num();
 	const bool HaveNormal = Normals.Num() == VertexCount;
 	const bool HaveUV = UVs.Num() == VertexCount;
-	for ( int32 Index = 0; Index < VertexCount; ++Index )
+	MeshSectionCPU.Positions.SetNumUninitialized(VertexCount);
+	MeshSectionCPU.Normals.SetNumUninitialized(VertexCount);
+	if ( m_bHalfPrecisionUV )
+	{
+		MeshSectionCPU.HalfUVs.SetNumUninitialized(VertexCount);
+	}
+	else
+	{
+		MeshSectionCPU.UVs.SetNumUninitialized(VertexCount);
+	}
+	ParallelFor(VertexCount, [&](int32 Index)
+	{
+		MeshSectionCPU.Positions[Index] = FVector3f(Vertices[Index]);
+		MeshSectionCPU.Normals[Index] = FPackedNormal(HaveNormal ? FVector3f(Normals[Index]) : FVector3f::ZeroVector);
+		const FVector2f TexCoord(HaveUV ? FVector2f(UVs[Index]) : FVector2f::ZeroVector);
+		if ( m_bHalfPrecisionUV )
+		{
+			MeshSectionCPU.HalfUVs[Index] = FVector2DHalf(TexCoord);
+		}
+		else
+		{
+			MeshSectionCPU.UVs[Index] = TexCoord;
+		}
+	});
+	if ( Colors.Num() == VertexCount )
 	{
-		FVector3f Position(Vertices[Index]);
-		FVector3f TangentX(HaveNormal && HaveUV ? FVector3f::ForwardVector : FVector3f::ForwardVector);
-		FVector3f TangentZ(HaveNormal ? FVector3f(Normals[Index]) : FVector3f::ZeroVector);
-		FVector2f TexCoord(HaveUV ? FVector2f(UVs[Index]) : FVector2f::ZeroVector);
-		MeshSectionCPU.Vertices.Add( FDynamicMeshVertex( Position, TangentX, TangentZ, TexCoord, FColor::White ) );
+		MeshSectionCPU.Colors = Colors;
 	}
 
 	for ( int32 Index = 0; Index < Triangles.Num(); Index += 3 )
@@ -346,11 +636,15 @@ int UDTMeshComponent::AddMeshSection(const TArray<FVector>& Vertices, const TArr
 		}
 	}
 	MeshSectionCPU.LocalBox = FBox(Vertices);
+
+	// 构建GPU数据, 场景代理直接引用
+	BuildSectionGPU(MeshSectionCPU, GetScene() ? GetScene()->GetFeatureLevel() : GMaxRHIFeatureLevel);
 	
 	// 更新本地盒子
 	UpdateLocalBounds();
 
 	// 创建碰撞体
+	RebuildCollisionChunks();
 	UpdateBodySetup();
 
 	// 重新绘画
@@ -370,62 +664,17 @@ bool UDTMeshComponent::UpdateVertexPosition(uint32 SectionIndex, uint32 VertexIn
 
 	// 判断顶点有效
 	FDTMeshSectionCPU & MeshSectionCPU = m_MeshSections[SectionIndex];
-	if ( !MeshSectionCPU.Vertices.IsValidIndex(VertexIndex) )
+	if ( !MeshSectionCPU.Positions.IsValidIndex(VertexIndex) )
 	{
 		return false;
 	}
 
 	// 修改顶点
-	FVector3f Position(UpdatePosition);
-	if ( Position.Equals(MeshSectionCPU.Vertices[VertexIndex].Position) )
+	if ( !EditVertexPosition(MeshSectionCPU, VertexIndex, FVector3f(UpdatePosition)) )
 	{
 		return false;
 	}
-
-	// 更新CPU顶点
-	MeshSectionCPU.Vertices[VertexIndex].Position = Position;
-
-	// 更新GPU
-	ENQUEUE_RENDER_COMMAND(UpdateVertexPosition)([this, SectionIndex, VertexIndex, Position](FRHICommandListImmediate& RHICmdList)
-	{
-		// 判断部件有效
-		if ( !m_MeshSceneProxy->m_MeshSections.IsValidIndex(SectionIndex) )
-		{
-			return;
-		}
-
-		// 判断顶点有效
-		FDTMeshSectionGPU * MeshSectionGPU = m_MeshSceneProxy->m_MeshSections[SectionIndex];
-		if ( VertexIndex >= MeshSectionGPU->VertexBuffers.PositionVertexBuffer.GetNumVertices() )
-		{
-			return;
-		}
-
-		// 更新GPU缓存顶点
-		FPositionVertexBuffer & PositionVertexBuffer = MeshSectionGPU->VertexBuffers.PositionVertexBuffer;
-		FLocalVertexFactory & LocalVertexFactory = MeshSectionGPU->VertexFactory;
-		FBufferRHIRef & VertexBufferRHI = MeshSectionGPU->VertexBuffers.PositionVertexBuffer.VertexBufferRHI;
-		FVector3f& VertexPosition = PositionVertexBuffer.VertexPosition(VertexIndex);
-		VertexPosition = Position;
-		
-		// 更新实际GPU顶点
-		if ( VertexBufferRHI )
-		{
-			FVector3f* Buffer = (FVector3f*)RHICmdList.LockBuffer(VertexBufferRHI, VertexIndex * sizeof(FVector3f), sizeof(FVector3f), RLM_WriteOnly_NoOverwrite);
-			Buffer->Set(VertexPosition.X, VertexPosition.Y, VertexPosition.Z);
-			RHICmdList.UnlockBuffer(VertexBufferRHI);
-		}
-	});
-
-	// 更新盒子
-	MeshSectionCPU.LocalBox = GetBox(MeshSectionCPU.Vertices);
-	
-	// 更新本地盒子
-	UpdateLocalBounds();
-
-	// 更新碰撞体
-	UpdateBodySetup();
-	
+	RequestVertexFlush();
 	return true;
 }
 
@@ -440,7 +689,7 @@ bool UDTMeshComponent::OffsetVertexPosition(uint32 SectionIndex, uint32 VertexIn
 
 	// 判断顶点有效
 	FDTMeshSectionCPU & MeshSectionCPU = m_MeshSections[SectionIndex];
-	if ( !MeshSectionCPU.Vertices.IsValidIndex(VertexIndex) )
+	if ( !MeshSectionCPU.Positions.IsValidIndex(VertexIndex) )
 	{
 		return false;
 	}
@@ -451,53 +700,186 @@ bool UDTMeshComponent::OffsetVertexPosition(uint32 SectionIndex, uint32 VertexIn
 	{
 		return false;
 	}
+	if ( !EditVertexPosition(MeshSectionCPU, VertexIndex, MeshSectionCPU.Positions[VertexIndex] + Position) )
+	{
+		return false;
+	}
+	RequestVertexFlush();
+	return true;
+}
+
+// 批量更新点
+int32 UDTMeshComponent::UpdateVertexPositions(uint32 SectionIndex, TConstArrayView<int32> VertexIndices, TConstArrayView<FVector> UpdatePositions)
+{
+	// 判断部件有效
+	if ( !m_MeshSections.IsValidIndex(SectionIndex) || VertexIndices.Num() != UpdatePositions.Num() )
+	{
+		return 0;
+	}
+
+	FDTMeshSectionCPU & MeshSectionCPU = m_MeshSections[SectionIndex];
+	int32 EditCount = 0;
+	for ( int32 Index = 0; Index < VertexIndices.Num(); ++Index )
+	{
+		const int32 VertexIndex = VertexIndices[Index];
+		if ( MeshSectionCPU.Positions.IsValidIndex(VertexIndex) && EditVertexPosition(MeshSectionCPU, VertexIndex, FVector3f(UpdatePositions[Index])) )
+		{
+			++EditCount;
+		}
+	}
+	if ( EditCount > 0 )
+	{
+		RequestVertexFlush();
+	}
+	return EditCount;
+}
 
-	// 更新CPU顶点
-	MeshSectionCPU.Vertices[VertexIndex].Position += Position;
-	FVector PositionNew(MeshSectionCPU.Vertices[VertexIndex].Position);
+// 修改CPU顶点并记录等待上传
+bool UDTMeshComponent::EditVertexPosition(FDTMeshSectionCPU& MeshSectionCPU, int32 VertexIndex, const FVector3f& Position)
+{
+	FVector3f & VertexPosition = MeshSectionCPU.Positions[VertexIndex];
+	if ( Position.Equals(VertexPosition) )
+	{
+		return false;
+	}
 
-	// 更新GPU
-	ENQUEUE_RENDER_COMMAND(OffsetVertexPosition)([this, SectionIndex, VertexIndex, Position](FRHICommandListImmediate& RHICmdList)
+	// 盒子增量更新, 原来的点在盒子表面时盒子可能缩小, 帧末重新计算
+	if ( !MeshSectionCPU.bBoxDirty )
 	{
-		// 判断部件有效
-		if ( !m_MeshSceneProxy->m_MeshSections.IsValidIndex(SectionIndex) )
+		const FVector Min = MeshSectionCPU.LocalBox.Min;
+		const FVector Max = MeshSectionCPU.LocalBox.Max;
+		if ( VertexPosition.X <= Min.X || VertexPosition.Y <= Min.Y || VertexPosition.Z <= Min.Z ||
+			 VertexPosition.X >= Max.X || VertexPosition.Y >= Max.Y || VertexPosition.Z >= Max.Z )
 		{
-			return;
+			MeshSectionCPU.bBoxDirty = true;
 		}
+		else
+		{
+			MeshSectionCPU.LocalBox += FVector(Position);
+		}
+	}
+	// 标记包含原来位置的碰撞分块
+	m_Collision.MarkDirty(VertexPosition);
+	VertexPosition = Position;
+
+	// 记录等待上传的点
+	if ( MeshSectionCPU.DirtyVertices.Num() != MeshSectionCPU.Positions.Num() )
+	{
+		MeshSectionCPU.DirtyVertices.Init(false, MeshSectionCPU.Positions.Num());
+	}
+	MeshSectionCPU.DirtyVertices[VertexIndex] = true;
+	MeshSectionCPU.DirtyMin = FMath::Min(MeshSectionCPU.DirtyMin, VertexIndex);
+	MeshSectionCPU.DirtyMax = FMath::Max(MeshSectionCPU.DirtyMax, VertexIndex);
+	return true;
+}
+
+// 开始等待帧末提交
+void UDTMeshComponent::RequestVertexFlush()
+{
+	m_bVertexDirty = true;
+	m_bCollisionDirty = m_Collision.Source != EDTMeshCollisionSource::None;
+	SetComponentTickEnabled(true);
+}
 
-		// 判断顶点有效
-		FDTMeshSectionGPU * MeshSectionGPU = m_MeshSceneProxy->m_MeshSections[SectionIndex];
-		if ( VertexIndex >= MeshSectionGPU->VertexBuffers.PositionVertexBuffer.GetNumVertices() )
+// 立即上传等待的顶点编辑
+void UDTMeshComponent::FlushVertexEdits()
+{
+	if ( m_bVertexDirty )
+	{
+		m_bVertexDirty = false;
+		bool bBoundsChanged = false;
+		for ( FDTMeshSectionCPU & MeshSectionCPU : m_MeshSections )
 		{
-			return;
+			if ( MeshSectionCPU.DirtyMax < 0 )
+			{
+				continue;
+			}
+
+			// 连续修改的点合并为区间, 间隔较小的区间也合并, 每个区间只锁定一次
+			TArray<FDTMeshVertexRange> ArrayRange;
+			TArray<FVector3f> ArrayPosition;
+			for ( int32 VertexIndex = MeshSectionCPU.DirtyMin; VertexIndex <= MeshSectionCPU.DirtyMax; ++VertexIndex )
+			{
+				if ( !MeshSectionCPU.DirtyVertices[VertexIndex] )
+				{
+					continue;
+				}
+				MeshSectionCPU.DirtyVertices[VertexIndex] = false;
+				if ( ArrayRange.Num() > 0 && VertexIndex - (ArrayRange.Last().Begin + ArrayRange.Last().Count) <= DTMeshEditMergeGap )
+				{
+					ArrayRange.Last().Count = VertexIndex + 1 - ArrayRange.Last().Begin;
+				}
+				else
+				{
+					ArrayRange.Add( { VertexIndex, 1 } );
+				}
+			}
+			for ( const FDTMeshVertexRange & Range : ArrayRange )
+			{
+				ArrayPosition.Append(MeshSectionCPU.Positions.GetData() + Range.Begin, Range.Count);
+			}
+			MeshSectionCPU.DirtyMin = MAX_int32;
+			MeshSectionCPU.DirtyMax = -1;
+
+			// 更新GPU
+			ENQUEUE_RENDER_COMMAND(UpdateVertexPositions)([MeshSectionGPU = MeshSectionCPU.GPU, ArrayRange = MoveTemp(ArrayRange), ArrayPosition = MoveTemp(ArrayPosition)](FRHICommandListImmediate& RHICmdList)
+			{
+				if ( !MeshSectionGPU.IsValid() )
+				{
+					return;
+				}
+
+				FPositionVertexBuffer & PositionVertexBuffer = MeshSectionGPU->VertexBuffers.PositionVertexBuffer;
+				FBufferRHIRef & VertexBufferRHI = PositionVertexBuffer.VertexBufferRHI;
+				const FVector3f * Source = ArrayPosition.GetData();
+				for ( const FDTMeshVertexRange & Range : ArrayRange )
+				{
+					// 判断顶点有效
+					if ( static_cast<uint32>(Range.Begin + Range.Count) > PositionVertexBuffer.GetNumVertices() )
+					{
+						break;
+					}
+
+					// 更新GPU顶点, 上传后顶点缓冲没有CPU副本, 上传前写入等待上传的数据
+					const uint32 Size = Range.Count * sizeof(FVector3f);
+					if ( VertexBufferRHI )
+					{
+						void * Buffer = RHICmdList.LockBuffer(VertexBufferRHI, Range.Begin * sizeof(FVector3f), Size, RLM_WriteOnly_NoOverwrite);
+						FMemory::Memcpy(Buffer, Source, Size);
+						RHICmdList.UnlockBuffer(VertexBufferRHI);
+					}
+					else
+					{
+						FMemory::Memcpy(&PositionVertexBuffer.VertexPosition(Range.Begin), Source, Size);
+					}
+					Source += Range.Count;
+				}
+
+				// 编辑期间使用动态绘画
+				MeshSectionGPU->NotifyVertexEdited();
+			});
+
+			// 更新盒子
+			if ( MeshSectionCPU.bBoxDirty )
+			{
+				MeshSectionCPU.LocalBox = GetBox(MeshSectionCPU.Positions);
+				MeshSectionCPU.bBoxDirty = false;
+			}
+			bBoundsChanged = true;
 		}
 
-		// 更新GPU缓存顶点
-		FPositionVertexBuffer & PositionVertexBuffer = MeshSectionGPU->VertexBuffers.PositionVertexBuffer;
-		FLocalVertexFactory & LocalVertexFactory = MeshSectionGPU->VertexFactory;
-		FBufferRHIRef & VertexBufferRHI = MeshSectionGPU->VertexBuffers.PositionVertexBuffer.VertexBufferRHI;
-		FVector3f & VertexPosition = PositionVertexBuffer.VertexPosition(VertexIndex);
-		VertexPosition += Position;
-		
-		// 更新实际GPU顶点
-		if ( VertexBufferRHI )
+		// 更新本地盒子
+		if ( bBoundsChanged )
 		{
-			FVector3f* Buffer = (FVector3f*)RHICmdList.LockBuffer(VertexBufferRHI, VertexIndex * sizeof(FVector3f), sizeof(FVector3f), RLM_WriteOnly_NoOverwrite);
-			Buffer->Set(VertexPosition.X, VertexPosition.Y, VertexPosition.Z);
-			RHICmdList.UnlockBuffer(VertexBufferRHI);
+			UpdateLocalBounds();
 		}
-	});
+	}
 
-	// 更新盒子
-	MeshSectionCPU.LocalBox = GetBox(MeshSectionCPU.Vertices);
-	
-	// 更新本地盒子
-	UpdateLocalBounds();
-	
-	// 更新碰撞体
-	UpdateBodySetup();
-	
-	return true;
+	// 更新碰撞体, 连续编辑时按间隔重新生成, 分块时只生成修改过的分块
+	if ( m_bCollisionDirty && FPlatformTime::Seconds() - m_CollisionTime >= DTMeshCollisionInterval )
+	{
+		UpdateBodySetup(false);
+	}
 }
 
 void UDTMeshComponent::BeforeHitTest()
@@ -8,31 +8,48 @@
 #include "DynamicMeshBuilder.h"
 #include "MaterialDomain.h"
 #include "Components/MeshComponent.h"
+#include "DTMeshCollision.h"
 #include "DTMeshComponent.generated.h"
 
 class UDTMeshComponent;
 
-// GUP保存的模型数据
+// GPU保存的模型数据, 工作线程填充, 组件和所有场景代理共享同一份, 最后一个引用释放时在渲染线程删除
 struct FDTMeshSectionGPU
 {
-	UMaterialInterface *							MaterialInterface;			// 材质接口
+	const ERHIFeatureLevel::Type					FeatureLevel;				// 特性等级
 	FStaticMeshVertexBuffers						VertexBuffers;				// GPU顶点缓存
 	FLocalVertexFactory								VertexFactory;				// GPU顶点代理
 	FDynamicMeshIndexBuffer32						IndexBuffer;				// 索引缓存
+	int32											NumIndices;					// 索引数量, 上传后仍然有效
+	uint64											EditEndFrame;				// 编辑结束帧, 之前使用动态绘画 (渲染线程)
 
-	FDTMeshSectionGPU(UMaterialInterface * InMaterialInterface, ERHIFeatureLevel::Type InFeatureLevel)
-	: MaterialInterface(InMaterialInterface ? InMaterialInterface : UMaterial::GetDefaultMaterial(MD_Surface))
+	FDTMeshSectionGPU(ERHIFeatureLevel::Type InFeatureLevel)
+	: FeatureLevel(InFeatureLevel)
 	, VertexFactory(InFeatureLevel, "FDTMeshSectionGPU")
+	, NumIndices(0)
+	, EditEndFrame(0)
 	{}
+	// 析构函数, 释放渲染资源
+	~FDTMeshSectionGPU();
+
+	// 创建共享数据
+	static TSharedPtr<FDTMeshSectionGPU, ESPMode::ThreadSafe> Create(ERHIFeatureLevel::Type InFeatureLevel);
+	// 创建渲染资源, 多个场景代理共享时只创建一次 (渲染线程)
+	void InitResources(FRHICommandListBase& RHICmdList);
+	// 顶点被编辑, 之后一段时间使用动态绘画 (渲染线程)
+	void NotifyVertexEdited();
 };
+typedef TSharedPtr<FDTMeshSectionGPU, ESPMode::ThreadSafe> FDTMeshSectionGPUPtr;
 
 // 场景代理体
 class FDTMeshSceneProxy final : public FPrimitiveSceneProxy
 {
 
 public:
-	TArray<FDTMeshSectionGPU*>						m_MeshSections;					// 模型分块缓冲
+	TArray<FDTMeshSectionGPUPtr>					m_MeshSections;					// 模型分块缓冲, 与组件共享
+	TArray<UMaterialInterface*>						m_MaterialInterfaces;			// 模型分块材质
 	FMaterialRelevance								m_MaterialRelevance;			// 材质属性
+	const bool										m_bStaticDraw;					// 静态绘画, 渲染器缓存绘画命令
 
 public:
 	// 构造函数
@@ -40,6 +57,9 @@ public:
 	// 析构函数
 	virtual ~FDTMeshSceneProxy() override;
 
+	// 当前是否使用静态绘画
+	bool IsStaticDrawing(const FSceneView* View) const;
+
 	// 继承函数
 protected:
 	// 返回Hash值
@@ -56,16 +76,34 @@ protected:
 #else
 	virtual void CreateRenderThreadResources() override;
 #endif
+	// 绘画静态元素, 添加到场景时缓存绘画命令
+	virtual void DrawStaticElements(FStaticPrimitiveDrawInterface* PDI) override;
 	// 绘画动态元素
 	virtual void GetDynamicMeshElements(const TArray<const FSceneView*>& Views, const FSceneViewFamily& ViewFamily, uint32 VisibilityMap, FMeshElementCollector& Collector) const override;
 };
 
-// CPU保存的模型数据
+// CPU保存的模型数据, 按数据流分开保存, 只保存实际使用的属性
 struct FDTMeshSectionCPU
 {
 	FBox											LocalBox;				// 本地盒子
-	TArray<FDynamicMeshVertex>						Vertices;				// 点位置数据
+	TArray<FVector3f>								Positions;				// 点位置
+	TArray<FPackedNormal>							Normals;				// 压缩法线
+	TArray<FVector2f>								UVs;					// UV, 全精度
+	TArray<FVector2DHalf>							HalfUVs;				// UV, 半精度, 与 UVs 只保存一份
+	TArray<FColor>									Colors;					// 顶点颜色, 为空时使用白色
 	TArray<FUintVector>								Triangles;				// 三角形索引
+	FDTMeshSectionGPUPtr							GPU;					// GPU数据, 与场景代理共享
+	TBitArray<>										DirtyVertices;			// 等待上传的点
+	int32											DirtyMin = MAX_int32;	// 等待上传的最小点索引
+	int32											DirtyMax = -1;			// 等待上传的最大点索引
+	bool											bBoxDirty = false;		// 盒子需要重新计算
+
+	// 点数量
+	int32 NumVertices() const { return Positions.Num(); }
+	// 是否半精度UV
+	bool IsHalfPrecisionUV() const { return HalfUVs.Num() != 0; }
+	// 获取UV
+	FVector2f GetUV(int32 Index) const { return IsHalfPrecisionUV() ? FVector2f(HalfUVs[Index]) : UVs[Index]; }
 };
 
 // 自定义模式实验
@@ -82,14 +120,29 @@ private:
 
 	// 场景代理
 	FDTMeshSceneProxy *								m_MeshSceneProxy;
+
+	// 静态绘画, 关闭时每帧动态绘画
+	bool											m_bStaticDraw;
+
+	// 新添加的部件使用半精度UV
+	bool											m_bHalfPrecisionUV;
+
+	// 有等待上传的顶点
+	bool											m_bVertexDirty;
+
+	// 碰撞体需要重新生成
+	bool											m_bCollisionDirty;
+
+	// 上次生成碰撞体的时间
+	double											m_CollisionTime;
 	
 	// 本地局部边界
 	UPROPERTY(Transient)
 	FBoxSphereBounds								m_LocalBounds;
 
-	// 碰撞体
-	UPROPERTY(Instanced)
-	TObjectPtr<class UBodySetup>					m_BodySetup;
+	// 碰撞体, 异步生成时旧碰撞体使用到新碰撞体完成
+	UPROPERTY(Transient)
+	FDTMeshCollision								m_Collision;
 
 public:
 	// 构造函数
@@ -98,6 +151,8 @@ public:
 protected:
 	// 开始播放
 	virtual void BeginPlay() override;
+	// 帧末提交顶点编辑
+	virtual void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
 
 	// 组件继承回调
 public:
@@ -125,23 +180,53 @@ public:
 	TArray<FDTMeshSectionCPU> & GetMeshSections() { return m_MeshSections; }
 	// 获取场景代理
 	FDTMeshSceneProxy * GetSceneProxy() const { return m_MeshSceneProxy; }
+	// 是否静态绘画
+	bool IsStaticDraw() const { return m_bStaticDraw; }
+	// 是否半精度UV
+	bool IsHalfPrecisionUV() const { return m_bHalfPrecisionUV; }
 
 	// 功能函数
 public:
 	// 获取BOX
-	FBox GetBox( const TArray<FDynamicMeshVertex> & Vertices ) const;
+	FBox GetBox( const TArray<FVector3f> & Positions ) const;
 	// 更新本地区域
 	void UpdateLocalBounds();
-	// 更新碰撞体
-	void UpdateBodySetup();
+	// 更新碰撞体, 分块时 bFull 为 false 只重新生成修改过的分块
+	void UpdateBodySetup(bool bFull = true);
+	// 设置异步生成碰撞体, 生成期间继续使用旧碰撞体
+	void SetAsyncCooking(bool bAsyncCooking) { m_Collision.bAsyncCooking = bAsyncCooking; }
+	// 设置碰撞分块边长, 小于等于 0 时整体生成, 修改后重新生成
+	void SetCollisionChunkSize(double ChunkSize);
+	// 设置碰撞数据来源, 简化来源按 DecimateSize 合并点, 修改后重新生成
+	void SetCollisionSource(EDTMeshCollisionSource Source, double DecimateSize = 0.0);
+	// 设置静态绘画, 重新创建场景代理
+	void SetStaticDraw(bool bStaticDraw);
+	// 设置半精度UV, 之后添加的部件生效
+	void SetHalfPrecisionUV(bool bHalfPrecisionUV) { m_bHalfPrecisionUV = bHalfPrecisionUV; }
+	// 构建GPU数据, 数据流直接复制到对应的顶点缓冲
+	void BuildSectionGPU(FDTMeshSectionCPU & MeshSectionCPU, ERHIFeatureLevel::Type FeatureLevel) const;
 	
 public:
 	// 创建模型
-	int AddMeshSection(const TArray<FVector>& Vertices, const TArray<int32>& Triangles, const TArray<FVector>& Normals, const TArray<FVector2D>& UVs);
-	// 更新点
+	int AddMeshSection(const TArray<FVector>& Vertices, const TArray<int32>& Triangles, const TArray<FVector>& Normals, const TArray<FVector2D>& UVs, const TArray<FColor>& Colors = TArray<FColor>());
+	// 更新点, 同一帧的修改在帧末合并上传
 	bool UpdateVertexPosition( uint32 SectionIndex, uint32 VertexIndex, const FVector & UpdatePosition );
-	// 偏移点
+	// 偏移点, 同一帧的修改在帧末合并上传
 	bool OffsetVertexPosition( uint32 SectionIndex, uint32 VertexIndex, const FVector & OffsetPosition );
+	// 批量更新点, 返回修改的点数量
+	int32 UpdateVertexPositions( uint32 SectionIndex, TConstArrayView<int32> VertexIndices, TConstArrayView<FVector> UpdatePositions );
+	// 立即上传等待的顶点编辑, 更新盒子, 碰撞体按间隔重新生成
+	void FlushVertexEdits();
+
+private:
+	// 重新划分碰撞分块
+	void RebuildCollisionChunks();
+	// 修改CPU顶点并记录等待上传
+	bool EditVertexPosition( FDTMeshSectionCPU & MeshSectionCPU, int32 VertexIndex, const FVector3f & Position );
+	// 开始等待帧末提交
+	void RequestVertexFlush();
+
+public:
 
 	UFUNCTION(BlueprintCallable)
 	void BeforeHitTest();
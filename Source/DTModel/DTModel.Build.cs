@@ -20,6 +20,7 @@ public class DTModel : ModuleRules
 		{
 			"Engine", 
 			"GeometryCore",
+			"DynamicMesh",
 			"ProceduralMeshComponent", 
 			"MeshConversion",
 			"MeshDescription",
@@ -6,7 +6,6 @@
 
 #include "DTTools.h"
 #include "ProceduralMeshComponent.h"
-#include "CompGeom/Delaunay2.h"
 #include "PhysicsEngine/BodySetup.h"
 #include "StaticMeshAttributes.h"
 #include "Components/ActorComponent.h"
@@ -18,6 +17,7 @@
 #include "RealtimeMeshSimple.h"
 #include "DTMeshComponent/DTStaticMeshComponent.h"
 #include "DTTerrainComponent/DTTerrainComponent.h"
+#include "DTTools/DTMeshCache.h"
 
 #if 1
 	#define GENERATE_SIZE			(600)							// 生成大小
@@ -35,15 +35,6 @@ static TArray<FVector>		g_ArrayNormals;						// 点法线数据
 static TArray<int32>		g_ArrayTriangles;					// 三角面索引
 static TArray<FVector2D>	g_ArrayUVs;							// UV
 
-#define LOAD_FILE(T, F, V)															\
-if ( FPaths::FileExists(F) )														\
-{																					\
-	V.Empty();																		\
-	TArray<uint8> Result;															\
-	FFileHelper::LoadFileToArray(Result, *F);										\
-	V.Append( (T*)Result.GetData(), Result.Num() / sizeof(T) );						\
-}
-
 // 构造函数
 ADTModelTestActor::ADTModelTestActor()
 {
@@ -69,19 +60,20 @@ void ADTModelTestActor::BeginPlay()
 	Super::BeginPlay();
 
 	// 读取临时文件
-	FString FilePoints = FPaths::Combine(FPlatformProcess::UserTempDir(), FString::Printf(TEXT("E8D1FE5B601FA4B358B95BCEBBAB353A-%d-%d-%d.Points"), GENERATE_SIZE, GENERATE_INTERVAL, GENERATE_HEIGHT));
-	FString FileNormals = FPaths::Combine(FPlatformProcess::UserTempDir(), FString::Printf(TEXT("E9BFF36BC5A4326FE333BAB60BB0FD31-%d-%d-%d.Normals"), GENERATE_SIZE, GENERATE_INTERVAL, GENERATE_HEIGHT));
-	FString FileUVs = FPaths::Combine(FPlatformProcess::UserTempDir(), FString::Printf(TEXT("3664A2DB7A736C0943B3F3C0412CA546-%d-%d-%d.UVs"), GENERATE_SIZE, GENERATE_INTERVAL, GENERATE_HEIGHT));
-	FString FileTriangles = FPaths::Combine(FPlatformProcess::UserTempDir(), FString::Printf(TEXT("8B973A92E9A0E9EC7BC409CB3279F25F-%d-%d-%d.Triangles"), GENERATE_SIZE, GENERATE_INTERVAL, GENERATE_HEIGHT));
+	const FString FileCache = FPaths::Combine(FPlatformProcess::UserTempDir(), FString::Printf(TEXT("E8D1FE5B601FA4B358B95BCEBBAB353A-%d-%d-%d.dtmesh"), GENERATE_SIZE, GENERATE_INTERVAL, GENERATE_HEIGHT));
+	const uint64 ParamHash = (FDTMeshCacheHash() << GENERATE_SIZE << GENERATE_INTERVAL << GENERATE_HEIGHT).Get();
 
 	// 生成一次全局点
 	if ( g_ArrayPoints.Num() == 0 )
 	{
-		// 重新读取数据
-		LOAD_FILE(FVector, FilePoints, g_ArrayPoints);
-		LOAD_FILE(FVector, FileNormals, g_ArrayNormals);
-		LOAD_FILE(FVector2D, FileUVs, g_ArrayUVs);
-		LOAD_FILE(int32, FileTriangles, g_ArrayTriangles);
+		// 重新读取数据, 从映射的文件直接复制到全局数组
+		if ( FDTMeshCachePtr Cache = FDTMeshCache::Load(FileCache, ParamHash) )
+		{
+			g_ArrayPoints = Cache->GetStream<FVector>(EDTMeshCacheStream::Points);
+			g_ArrayNormals = Cache->GetStream<FVector>(EDTMeshCacheStream::Normals);
+			g_ArrayUVs = Cache->GetStream<FVector2D>(EDTMeshCacheStream::UVs);
+			g_ArrayTriangles = Cache->GetStream<int32>(EDTMeshCacheStream::Triangles);
+		}
 
 		// 读取成功
 		if ( g_ArrayPoints.Num() && g_ArrayNormals.Num() && g_ArrayUVs.Num() && g_ArrayTriangles.Num()
@@ -110,40 +102,25 @@ void ADTModelTestActor::BeginPlay()
 		}
 
 		// 生成三角面
-		UE::Geometry::FDelaunay2 Delaunay;
-		Delaunay.Triangulate(ArrayVector2D);
-		TArray<UE::Geometry::FIndex3i> ArrayIndex = Delaunay.GetTriangles();
+		UDTTools::TriangulateGrid(nSize * 2 + 1, nSize * 2 + 1, g_ArrayTriangles);
 
-		// 关联索引
-		TMap<int, TArray<UE::Geometry::FIndex3i>> MapIndex;
-		
 		// 生成模型数据
 		for ( const FVector2D & Vector2D : ArrayVector2D )
 		{
 			g_ArrayPoints.Add(FVector(Vector2D.X, Vector2D.Y, FMath::RandHelper(GENERATE_HEIGHT)));
 			g_ArrayUVs.Add( FVector2D((Vector2D.X - (-nSize * nInterval)) / (nSize * nInterval * 2), (Vector2D.Y - (-nSize * nInterval)) / (nSize * nInterval * 2)) );
 		}
-		for ( const UE::Geometry::FIndex3i & Index3i : ArrayIndex )
-		{
-			g_ArrayTriangles.Add( Index3i.C );
-			g_ArrayTriangles.Add( Index3i.B );
-			g_ArrayTriangles.Add( Index3i.A );
-			MapIndex.FindOrAdd(Index3i.C).Add(Index3i);
-			MapIndex.FindOrAdd(Index3i.B).Add(Index3i);
-			MapIndex.FindOrAdd(Index3i.A).Add(Index3i);
-		}
-	
+
 		// 计算点法线
-		for (int nPointIndex = 0; nPointIndex < g_ArrayPoints.Num(); nPointIndex++)
-		{
-			g_ArrayNormals.Add( UDTTools::CalculateVertexNormal(g_ArrayPoints, g_ArrayTriangles, MapIndex, nPointIndex) );
-		}
+		UDTTools::CalculateVertexNormals(g_ArrayPoints, g_ArrayTriangles, g_ArrayNormals);
 		
 		// 保存文件
-		FFileHelper::SaveArrayToFile(TArray64<uint8>((uint8*)g_ArrayPoints.GetData(), g_ArrayPoints.Num() * g_ArrayPoints.GetTypeSize()), *FilePoints);
-		FFileHelper::SaveArrayToFile(TArray64<uint8>((uint8*)g_ArrayNormals.GetData(), g_ArrayNormals.Num() * g_ArrayNormals.GetTypeSize()), *FileNormals);
-		FFileHelper::SaveArrayToFile(TArray64<uint8>((uint8*)g_ArrayUVs.GetData(), g_ArrayUVs.Num() * g_ArrayUVs.GetTypeSize()), *FileUVs);
-		FFileHelper::SaveArrayToFile(TArray64<uint8>((uint8*)g_ArrayTriangles.GetData(), g_ArrayTriangles.Num() * g_ArrayTriangles.GetTypeSize()), *FileTriangles);
+		FDTMeshCacheWriter CacheWriter;
+		CacheWriter.AddStream<FVector>(EDTMeshCacheStream::Points, g_ArrayPoints);
+		CacheWriter.AddStream<FVector>(EDTMeshCacheStream::Normals, g_ArrayNormals);
+		CacheWriter.AddStream<FVector2D>(EDTMeshCacheStream::UVs, g_ArrayUVs);
+		CacheWriter.AddStream<int32>(EDTMeshCacheStream::Triangles, g_ArrayTriangles);
+		CacheWriter.Save(FileCache, ParamHash);
 	}
 }
 
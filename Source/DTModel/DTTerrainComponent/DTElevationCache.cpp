@@ -0,0 +1,116 @@
+﻿// Copyright 2023-2024 Dexter.Wan. All Rights Reserved. 
+// EMail: 45141961@qq.com
+// Website: https://dt.cq.cn
+
+#include "DTElevationCache.h"
+
+UE_DISABLE_OPTIMIZATION_SHIP
+
+// 向下取整除法
+static int64 FloorDivide(int64 Value, int64 Divisor)
+{
+	const int64 Quotient = Value / Divisor;
+	return (Value % Divisor != 0 && (Value < 0) != (Divisor < 0)) ? Quotient - 1 : Quotient;
+}
+
+// 构造函数
+FDTElevationCache::FDTElevationCache(int64 Interval, int32 ChunkSize, int64 MemoryLimit, FFillFunction FillFunction, FSampleFunction SampleFunction)
+	: m_Interval(Interval)
+	, m_ChunkSize(ChunkSize)
+	, m_FillFunction(MoveTemp(FillFunction))
+	, m_SampleFunction(MoveTemp(SampleFunction))
+	, m_LruChunk(FMath::Max<int32>(1, static_cast<int32>(MemoryLimit / (static_cast<int64>(ChunkSize) * ChunkSize * sizeof(float)))))
+{
+}
+
+// 获取单个高程
+float FDTElevationCache::GetElevation(int64 X, int64 Y)
+{
+	// 不在格点上直接采样
+	if ( X % m_Interval != 0 || Y % m_Interval != 0 )
+	{
+		return m_SampleFunction(X, Y);
+	}
+
+	const int64 GridX = X / m_Interval;
+	const int64 GridY = Y / m_Interval;
+	const FIntPoint ChunkKey( static_cast<int32>(FloorDivide(GridX, m_ChunkSize)), static_cast<int32>(FloorDivide(GridY, m_ChunkSize)) );
+	const FDTElevationChunkPtr Chunk = FindOrCreateChunk(ChunkKey);
+	const int64 LocalX = GridX - static_cast<int64>(ChunkKey.X) * m_ChunkSize;
+	const int64 LocalY = GridY - static_cast<int64>(ChunkKey.Y) * m_ChunkSize;
+	return Chunk->Heights[LocalY * m_ChunkSize + LocalX];
+}
+
+// 批量获取高程
+void FDTElevationCache::GetElevations(const TArray<FVector2D>& ArrayPoint, TArray<float>& OutElevations)
+{
+	OutElevations.SetNumUninitialized(ArrayPoint.Num());
+
+	// 相邻的点通常在同一个分块, 保留上一次的分块
+	FIntPoint LastKey(MAX_int32, MAX_int32);
+	FDTElevationChunkPtr LastChunk;
+	for ( int32 Index = 0; Index < ArrayPoint.Num(); ++Index )
+	{
+		const int64 X = static_cast<int64>(ArrayPoint[Index].X);
+		const int64 Y = static_cast<int64>(ArrayPoint[Index].Y);
+		if ( X % m_Interval != 0 || Y % m_Interval != 0 )
+		{
+			OutElevations[Index] = m_SampleFunction(X, Y);
+			continue;
+		}
+
+		const int64 GridX = X / m_Interval;
+		const int64 GridY = Y / m_Interval;
+		const FIntPoint ChunkKey( static_cast<int32>(FloorDivide(GridX, m_ChunkSize)), static_cast<int32>(FloorDivide(GridY, m_ChunkSize)) );
+		if ( ChunkKey != LastKey )
+		{
+			LastChunk = FindOrCreateChunk(ChunkKey);
+			LastKey = ChunkKey;
+		}
+		const int64 LocalX = GridX - static_cast<int64>(ChunkKey.X) * m_ChunkSize;
+		const int64 LocalY = GridY - static_cast<int64>(ChunkKey.Y) * m_ChunkSize;
+		OutElevations[Index] = LastChunk->Heights[LocalY * m_ChunkSize + LocalX];
+	}
+}
+
+// 清空缓存
+void FDTElevationCache::Empty()
+{
+	FScopeLock ScopeLock(&m_Lock);
+	m_LruChunk.Empty(m_LruChunk.Max());
+}
+
+// 当前缓存的分块数量
+int32 FDTElevationCache::Num() const
+{
+	FScopeLock ScopeLock(&m_Lock);
+	return m_LruChunk.Num();
+}
+
+// 获取分块, 不存在时生成
+FDTElevationChunkPtr FDTElevationCache::FindOrCreateChunk(const FIntPoint& ChunkKey)
+{
+	{
+		FScopeLock ScopeLock(&m_Lock);
+		if ( const FDTElevationChunkPtr * pFindChunk = m_LruChunk.FindAndTouch(ChunkKey) )
+		{
+			return *pFindChunk;
+		}
+	}
+
+	// 在锁外生成, 高程由坐标唯一确定, 淘汰后重新生成的值与之前一致
+	TSharedPtr<FDTElevationChunk, ESPMode::ThreadSafe> Chunk = MakeShared<FDTElevationChunk, ESPMode::ThreadSafe>();
+	Chunk->Heights.SetNumUninitialized(m_ChunkSize * m_ChunkSize);
+	m_FillFunction(static_cast<int64>(ChunkKey.X) * m_ChunkSize * m_Interval, static_cast<int64>(ChunkKey.Y) * m_ChunkSize * m_Interval, m_Interval, m_ChunkSize, m_ChunkSize, Chunk->Heights.GetData());
+
+	// 其他线程已经生成时使用已有分块
+	FScopeLock ScopeLock(&m_Lock);
+	if ( const FDTElevationChunkPtr * pFindChunk = m_LruChunk.FindAndTouch(ChunkKey) )
+	{
+		return *pFindChunk;
+	}
+	m_LruChunk.Add(ChunkKey, Chunk);
+	return Chunk;
+}
+
+UE_ENABLE_OPTIMIZATION_SHIP
@@ -0,0 +1,50 @@
+﻿// Copyright 2023-2024 Dexter.Wan. All Rights Reserved. 
+// EMail: 45141961@qq.com
+// Website: https://dt.cq.cn
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/LruCache.h"
+
+// 高程分块
+struct FDTElevationChunk
+{
+	TArray<float>									Heights;				// 高程数据, [Y * ChunkSize + X]
+};
+typedef TSharedPtr<const FDTElevationChunk, ESPMode::ThreadSafe> FDTElevationChunkPtr;
+
+// 高程缓存, 按固定间隔的格点分块保存, 超过内存上限时淘汰最久未使用的分块
+class FDTElevationCache
+{
+public:
+	// 填充函数, 按 [Y * CountX + X] 写入 CountX * CountY 个高程
+	typedef TFunction<void(int64 BeginX, int64 BeginY, int64 Interval, int32 CountX, int32 CountY, float * OutHeights)> FFillFunction;
+	// 单点采样函数, 用于不在格点上的点
+	typedef TFunction<float(int64 X, int64 Y)> FSampleFunction;
+
+private:
+	const int64										m_Interval;				// 格点间隔
+	const int32										m_ChunkSize;			// 分块边长(格点数)
+	const FFillFunction								m_FillFunction;			// 填充函数
+	const FSampleFunction							m_SampleFunction;		// 单点采样函数
+	mutable FCriticalSection						m_Lock;					// 缓存锁
+	TLruCache<FIntPoint, FDTElevationChunkPtr>		m_LruChunk;				// 分块缓存
+
+public:
+	// 构造函数
+	FDTElevationCache(int64 Interval, int32 ChunkSize, int64 MemoryLimit, FFillFunction FillFunction, FSampleFunction SampleFunction);
+
+	// 获取单个高程
+	float GetElevation(int64 X, int64 Y);
+	// 批量获取高程
+	void GetElevations(const TArray<FVector2D> & ArrayPoint, TArray<float> & OutElevations);
+	// 清空缓存
+	void Empty();
+	// 当前缓存的分块数量
+	int32 Num() const;
+
+private:
+	// 获取分块, 不存在时生成
+	FDTElevationChunkPtr FindOrCreateChunk(const FIntPoint & ChunkKey);
+};
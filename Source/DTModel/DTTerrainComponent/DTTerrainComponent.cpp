@@ -4,19 +4,11 @@
 #include "DTTerrainComponent.h"
 #include "IndexTypes.h"
 #include "ProceduralMeshComponent.h"
-#include "CompGeom/Delaunay2.h"
+#include "Engine/GameViewportClient.h"
 #include "DTModel/DTTools.h"
 #include "DTModel/DTMeshComponent/DTHMeshComponent.h"
 #include "DTModel/DTMeshComponent/DTLODMeshComponent.h"
 
-#define LOAD_FILE(T, F, V)															\
-if ( FPaths::FileExists(F) )														\
-{																					\
-	V.Empty();																		\
-	TArray<uint8> Result;															\
-	FFileHelper::LoadFileToArray(Result, *F);										\
-	V.Append( (T*)Result.GetData(), Result.Num() / sizeof(T) );						\
-}
 static constexpr int64 TerrainInterval = 1000 * 100;								// 地形单片距离
 static constexpr int64 TerrainSize = 5 * TerrainInterval;							// 地图单边大小
 //static constexpr int64 TerrainSize = 20 * TerrainInterval;							// 地图单边大小
@@ -29,16 +21,58 @@ static constexpr int64 TerrainLODInterval1 = TerrainLODIntervalMin;					// LOD 1
 static constexpr int64 TerrainLODInterval2 = 20 * 100;								// LOD 2层间隔
 static constexpr int64 TerrainLODIntervalMax = 200 * 100;							// LOD 最大间隔
 static constexpr int64 TerrainLODDistance1 = TerrainInterval * 2;					// 地形LOD 1层距离
-static constexpr int64 TerrainLODDistance2 = TerrainInterval * 5;					// 地形LOD 2层距离	
+static constexpr int64 TerrainLODDistance2 = TerrainInterval * 5;					// 地形LOD 2层距离
+static constexpr float TerrainMaxPixelError = 0.0f;									// LOD允许的默认最大屏幕误差(像素), 0 使用距离分段
+static constexpr double TerrainReferenceWidth = 1920.0;								// 没有游戏视口时使用的视口宽度
+static constexpr int32 TerrainMaxTaskInFlight = 4;									// 同时生成的最大任务数
+static constexpr float TerrainFrameBudgetMs = 4.0f;									// 每帧创建和销毁组件的默认预算
+static constexpr int64 TerrainCameraCell = TerrainInterval / 4;						// 摄像机格子大小, 移出格子才重新计算LOD
+static constexpr int32 TerrainElevationChunkSize = 64;								// 高程缓存分块边长(格点数)
+static constexpr int64 TerrainElevationCacheBytes = 64 * 1024 * 1024;				// 高程缓存内存上限
+static constexpr int32 TerrainElevationRowsPerTask = 16;							// 高程分块并行采样时每个任务的最少行数
+static constexpr double TerrainElevationScale = 500.0;								// 噪声到高程的缩放
+static constexpr double TerrainHeightQuantum = 1.0 / 64.0;							// 缓存高度量化步长, 高度先对齐到步长, 缓存读写无损
+static constexpr int32 TerrainMeshPoolSize = 64;									// 回收组件的最大数量, 超出时销毁
+static constexpr double TerrainLODFadeTime = 0.5;									// LOD过渡时间(秒)
+// LOD过渡值在自定义图元数据中的位置, 正数淡入, 负数淡出
+// 过渡要求材质读取这个位置, 使用同一个抖动噪声 N (0-1): 值 >= 0 时 N < 值 的像素可见, 值 < 0 时 N >= 1 + 值 的像素可见, 两层LOD的像素互补
+// 当前的 /Game/Material 没有读取自定义图元数据, 所以 m_bLODFade 默认关闭, 直接切换LOD
+static constexpr int32 TerrainLODFadeDataIndex = 0;
+static constexpr double TerrainSkirtMargin = 10.0;									// 裙边在最大裂缝之外多出的深度
+static constexpr int64 TerrainCollisionInterval = 10 * 100;						// 碰撞格点间隔, 必须是最小间隔的整数倍
+static constexpr int64 TerrainCollisionLODInterval = TerrainLODIntervalMax;			// 带碰撞的LOD, 常驻的最大LOD地块提供整个地块的碰撞
 
 UE_DISABLE_OPTIMIZATION_SHIP
 
 // 构造函数
 UDTTerrainComponent::UDTTerrainComponent()
+	: m_FrameBudgetMs(TerrainFrameBudgetMs)
+	, m_MaxPixelError(TerrainMaxPixelError)
+	, m_bLODFade(false)
+	, m_NumTaskInFlight(0)
+	, m_CameraLocation(FVector::ZeroVector)
+	, m_CameraDirection(FVector::ForwardVector)
+	, m_CameraCell(FIntVector::ZeroValue)
+	, m_UpdateLocation(FVector::ZeroVector)
+	, m_bFullUpdate(true)
+	, m_ErrorScale(0.0)
+	, m_MaxLODError(0.0)
 {
 	PrimaryComponentTick.bCanEverTick = true;
 	m_FastNoiseWrapper = CreateDefaultSubobject<UFastNoiseWrapper>(TEXT("FastNoiseWrapper"));
 
+	// 高程缓存, 格点与最小间隔一致, 所有LOD的点都落在格点上
+	m_ElevationCache = MakeUnique<FDTElevationCache>(TerrainLODIntervalMin, TerrainElevationChunkSize, TerrainElevationCacheBytes,
+		[this](int64 BeginX, int64 BeginY, int64 Interval, int32 CountX, int32 CountY, float * OutHeights)
+		{
+			// 整块格点按行分给工作线程批量采样, 结果与逐点 GetNoise2D 一致, 与线程数无关
+			m_FastNoiseWrapper->GetNoise2DGridParallel(BeginX, BeginY, Interval, CountX, CountY, OutHeights, TerrainElevationRowsPerTask);
+		},
+		[this](int64 X, int64 Y)
+		{
+			return m_FastNoiseWrapper->GetNoise2D(X, Y);
+		});
+
 	// 加载材质
 	static ConstructorHelpers::FObjectFinder<UMaterial> MeshMaterial(TEXT("/Script/Engine.Material'/Game/Material.Material'"));
 	if (MeshMaterial.Succeeded()) { m_Material = MeshMaterial.Object; }
@@ -52,33 +86,289 @@ void UDTTerrainComponent::BeginPlay()
 	m_FastNoiseWrapper->SetupFastNoise();
 }
 
+// 结束播放
+void UDTTerrainComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	WaitAllTasks();
+	Super::EndPlay(EndPlayReason);
+}
+
+// 组件销毁
+void UDTTerrainComponent::OnComponentDestroyed(bool bDestroyingHierarchy)
+{
+	WaitAllTasks();
+	Super::OnComponentDestroyed(bDestroyingHierarchy);
+}
+
 // 每帧函数
 void UDTTerrainComponent::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
 {
 	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
 
+	const double BeginTime = FPlatformTime::Seconds();
+
 	// 获取玩家摄像机位置
-	const FVector & CameraLocation = GetWorld()->GetFirstPlayerController()->PlayerCameraManager->GetCameraLocation();
-	for ( auto & [ Point, Mesh ] : m_MapMesh )
+	const APlayerCameraManager * CameraManager = GetWorld()->GetFirstPlayerController()->PlayerCameraManager;
+	m_CameraLocation = CameraManager->GetCameraLocation();
+	m_CameraDirection = CameraManager->GetCameraRotation().Vector();
+
+	// 误差像素 = 偏差 * 视口半宽 / tan(视角 / 2) / 距离, 视角, 分辨率或误差阈值变化时更新所有地块
+	// 没有设置最大屏幕误差时比例为 0, 使用距离分段
+	FVector2D ViewportSize(TerrainReferenceWidth, 0.0);
+	if ( UGameViewportClient * GameViewport = GetWorld()->GetGameViewport() )
+	{
+		GameViewport->GetViewportSize(ViewportSize);
+	}
+	const double HalfFOV = FMath::DegreesToRadians(FMath::Clamp(CameraManager->GetFOVAngle(), 1.0f, 170.0f) * 0.5);
+	const double ErrorScale = m_MaxPixelError > 0.0f ? 0.5 * FMath::Max(ViewportSize.X, 1.0) / FMath::Tan(HalfFOV) / m_MaxPixelError : 0.0;
+	if ( !FMath::IsNearlyEqual(ErrorScale, m_ErrorScale, m_ErrorScale * 0.01) )
+	{
+		m_ErrorScale = ErrorScale;
+		m_bFullUpdate = true;
+	}
+
+	// 接收生成完成的区域, 在预算内创建组件
+	ReceiveFinished();
+	ProcessReady(BeginTime);
+	UpdateLODFades();
+	
+	// 摄像机移动到新的格子时, 只更新LOD可能变化的地块
+	TSet<FInt64Vector2> SetUpdate = MoveTemp(m_SetDirty);
+	const FIntVector CameraCell = GetCameraCell(m_CameraLocation);
+	if ( m_bFullUpdate )
 	{
-		int64 Distance = FVector::Distance( FVector(CameraLocation), FVector(Point.X, Point.Y, 0.0) );
-		if ( Distance < TerrainLODDistance1 )
+		m_MapMesh.GetKeys(SetUpdate);
+		m_bFullUpdate = false;
+		m_CameraCell = CameraCell;
+		m_UpdateLocation = m_CameraLocation;
+	}
+	else if ( CameraCell != m_CameraCell )
+	{
+		const int64 UpdateRadius = static_cast<int64>(FMath::Min(GetUpdateDistance(), static_cast<double>(TerrainSize * 4))) + TerrainCameraCell;
+		AddTilesInRange(m_UpdateLocation, UpdateRadius, SetUpdate);
+		AddTilesInRange(m_CameraLocation, UpdateRadius, SetUpdate);
+		m_CameraCell = CameraCell;
+		m_UpdateLocation = m_CameraLocation;
+	}
+	for ( const FInt64Vector2 & Point : SetUpdate )
+	{
+		if ( FDTMeshLOD * Mesh = m_MapMesh.Find(Point) )
 		{
-			if( Mesh.MeshLOD1 == nullptr ) { Mesh.MeshLOD1 = GenerateArea(Point.X - TerrainInterval / 2, Point.Y - TerrainInterval / 2, TerrainInterval, TerrainLODInterval1); }
-			DestroyMeshComponent(Mesh.MeshLOD2);
-			if( Mesh.MeshLODMax->IsVisible() ) { Mesh.MeshLODMax->SetHiddenInGame(true); }
+			UpdateTile(Point, *Mesh);
 		}
-		else if ( Distance < TerrainLODDistance2 )
+	}
+
+	// 启动等待中的请求
+	LaunchRequests();
+}
+
+// 更新单个地块的LOD
+void UDTTerrainComponent::UpdateTile(const FInt64Vector2& Point, FDTMeshLOD& Mesh)
+{
+	// 新的LOD生成完成前，继续显示当前LOD
+	bool bUseLOD1 = false;
+	bool bUseLOD2 = false;
+	if ( m_ErrorScale > 0.0 )
+	{
+		// 使用地块最近点的距离, 几何偏差投影到屏幕不超过最大屏幕误差时使用低精度LOD
+		const FVector Nearest( FMath::Clamp<double>(m_CameraLocation.X, Point.X - TerrainInterval / 2, Point.X + TerrainInterval / 2),
+								FMath::Clamp<double>(m_CameraLocation.Y, Point.Y - TerrainInterval / 2, Point.Y + TerrainInterval / 2), 0.0 );
+		const double Distance = FMath::Max(FVector::Distance(m_CameraLocation, Nearest), 1.0);
+		bUseLOD1 = Mesh.LODError2 * m_ErrorScale > Distance;
+		bUseLOD2 = Mesh.LODErrorMax * m_ErrorScale > Distance;
+	}
+	else
+	{
+		// 按地块中心的距离分段
+		const double Distance = FVector::Distance( m_CameraLocation, FVector(Point.X, Point.Y, 0.0) );
+		bUseLOD1 = Distance < TerrainLODDistance1;
+		bUseLOD2 = Distance < TerrainLODDistance2;
+	}
+
+	if ( bUseLOD1 )
+	{
+		if( Mesh.MeshLOD1 == nullptr ) { Mesh.MeshLOD1 = FindFadeOut(Mesh, TerrainLODInterval1); }
+		if( Mesh.MeshLOD1 == nullptr ) { RequestArea(Point, Mesh, TerrainLODInterval1); return; }
+		CancelArea(Mesh);
+		SwitchTileLOD(Point, Mesh, Mesh.MeshLOD1);
+	}
+	else if ( bUseLOD2 )
+	{
+		if( Mesh.MeshLOD2 == nullptr ) { Mesh.MeshLOD2 = FindFadeOut(Mesh, TerrainLODInterval2); }
+		if( Mesh.MeshLOD2 == nullptr ) { RequestArea(Point, Mesh, TerrainLODInterval2); return; }
+		CancelArea(Mesh);
+		SwitchTileLOD(Point, Mesh, Mesh.MeshLOD2);
+	}
+	else
+	{
+		CancelArea(Mesh);
+		SwitchTileLOD(Point, Mesh, Mesh.MeshLODMax);
+	}
+}
+
+// 地块LOD需要更新的最远距离
+double UDTTerrainComponent::GetUpdateDistance() const
+{
+	return m_ErrorScale > 0.0 ? m_MaxLODError * m_ErrorScale : static_cast<double>(TerrainLODDistance2);
+}
+
+// 切换地块显示的LOD
+void UDTTerrainComponent::SwitchTileLOD(const FInt64Vector2& Point, FDTMeshLOD& Mesh, UMeshComponent* MeshShow)
+{
+	// 不显示的LOD直接回收
+	if ( Mesh.MeshLOD1 != MeshShow && Mesh.MeshLOD1 != Mesh.MeshShow ) { ReleaseMeshComponent(Mesh.MeshLOD1); }
+	if ( Mesh.MeshLOD2 != MeshShow && Mesh.MeshLOD2 != Mesh.MeshShow ) { ReleaseMeshComponent(Mesh.MeshLOD2); }
+	if ( Mesh.MeshShow == MeshShow )
+	{
+		return;
+	}
+
+	// 正在淡出的组件重新显示时从当前进度反向过渡, 其他淡出直接结束
+	const double Now = FPlatformTime::Seconds();
+	double BeginTime = Now;
+	const int32 FadeIndex = Mesh.ArrayFadeOut.IndexOfByPredicate([MeshShow](const FDTMeshFadeOut & FadeOut) { return FadeOut.Mesh == MeshShow; });
+	if ( FadeIndex != INDEX_NONE )
+	{
+		const double Alpha = FMath::Clamp((Now - Mesh.FadeBeginTime) / TerrainLODFadeTime, 0.0, 1.0);
+		BeginTime = Now - (1.0 - Alpha) * TerrainLODFadeTime;
+		Mesh.ArrayFadeOut.RemoveAt(FadeIndex);
+	}
+	for ( const FDTMeshFadeOut & FadeOut : Mesh.ArrayFadeOut )
+	{
+		EndFadeOut(Mesh, FadeOut.Mesh);
+	}
+	Mesh.ArrayFadeOut.Reset();
+
+	// 当前LOD移出槽位开始淡出, 槽位可以重新请求
+	if ( Mesh.MeshShow != nullptr )
+	{
+		FDTMeshFadeOut & FadeOut = Mesh.ArrayFadeOut.AddDefaulted_GetRef();
+		FadeOut.Mesh = Mesh.MeshShow;
+		FadeOut.Interval = TerrainLODIntervalMax;
+		if ( Mesh.MeshShow == Mesh.MeshLOD1 ) { Mesh.MeshLOD1 = nullptr; FadeOut.Interval = TerrainLODInterval1; }
+		if ( Mesh.MeshShow == Mesh.MeshLOD2 ) { Mesh.MeshLOD2 = nullptr; FadeOut.Interval = TerrainLODInterval2; }
+	}
+
+	// 材质不支持过渡时直接切换, 旧LOD立即隐藏或回收
+	if ( !m_bLODFade )
+	{
+		for ( const FDTMeshFadeOut & FadeOut : Mesh.ArrayFadeOut )
 		{
-			DestroyMeshComponent(Mesh.MeshLOD1);
-			if( Mesh.MeshLOD2 == nullptr ) { Mesh.MeshLOD2 = GenerateArea(Point.X - TerrainInterval / 2, Point.Y - TerrainInterval / 2, TerrainInterval, TerrainLODInterval2); }
-			if( Mesh.MeshLODMax->IsVisible() ) { Mesh.MeshLODMax->SetHiddenInGame(true); }
+			EndFadeOut(Mesh, FadeOut.Mesh);
 		}
-		else
+		Mesh.ArrayFadeOut.Reset();
+	}
+
+	// 新LOD开始淡入
+	Mesh.MeshShow = MeshShow;
+	Mesh.FadeBeginTime = BeginTime;
+	SetFadeValue(MeshShow, Mesh.ArrayFadeOut.Num() ? static_cast<float>((Now - BeginTime) / TerrainLODFadeTime) : 1.0f);
+	MeshShow->SetHiddenInGame(false);
+	m_SetFade.Add(Point);
+}
+
+// 取回正在淡出的指定间隔组件
+UMeshComponent* UDTTerrainComponent::FindFadeOut(const FDTMeshLOD& Mesh, int64 Interval)
+{
+	// 组件仍留在淡出列表中, 切换到它时从当前进度反向过渡
+	const FDTMeshFadeOut * FadeOut = Mesh.ArrayFadeOut.FindByPredicate([Interval](const FDTMeshFadeOut & Item) { return Item.Interval == Interval; });
+	return FadeOut ? FadeOut->Mesh : nullptr;
+}
+
+// 结束组件的淡出
+void UDTTerrainComponent::EndFadeOut(const FDTMeshLOD& Mesh, UMeshComponent* MeshOut)
+{
+	SetFadeValue(MeshOut, 1.0f);
+	if ( MeshOut == Mesh.MeshLODMax )
+	{
+		MeshOut->SetHiddenInGame(true);
+	}
+	else
+	{
+		ReleaseMeshComponent(MeshOut);
+	}
+}
+
+// 更新所有正在过渡的地块
+void UDTTerrainComponent::UpdateLODFades()
+{
+	const double Now = FPlatformTime::Seconds();
+	for ( auto It = m_SetFade.CreateIterator(); It; ++It )
+	{
+		FDTMeshLOD * Mesh = m_MapMesh.Find(*It);
+		if ( Mesh == nullptr )
+		{
+			It.RemoveCurrent();
+			continue;
+		}
+
+		// 过渡结束, 淡出的组件隐藏或回收
+		const double Alpha = (Now - Mesh->FadeBeginTime) / TerrainLODFadeTime;
+		if ( Alpha >= 1.0 || !Mesh->ArrayFadeOut.Num() )
+		{
+			for ( const FDTMeshFadeOut & FadeOut : Mesh->ArrayFadeOut )
+			{
+				EndFadeOut(*Mesh, FadeOut.Mesh);
+			}
+			Mesh->ArrayFadeOut.Reset();
+			SetFadeValue(Mesh->MeshShow, 1.0f);
+			It.RemoveCurrent();
+			continue;
+		}
+
+		// 淡入和淡出使用互补的值
+		SetFadeValue(Mesh->MeshShow, static_cast<float>(Alpha));
+		for ( const FDTMeshFadeOut & FadeOut : Mesh->ArrayFadeOut )
 		{
-			DestroyMeshComponent(Mesh.MeshLOD1);
-			DestroyMeshComponent(Mesh.MeshLOD2);
-			if( !Mesh.MeshLODMax->IsVisible() ) { Mesh.MeshLODMax->SetHiddenInGame(false); }
+			SetFadeValue(FadeOut.Mesh, static_cast<float>(Alpha - 1.0));
+		}
+	}
+}
+
+// 设置组件的过渡值
+void UDTTerrainComponent::SetFadeValue(UMeshComponent* MeshComponent, float Value)
+{
+	if ( MeshComponent == nullptr )
+	{
+		return;
+	}
+
+	// 没有设置过的自定义数据在材质中为 0, 所以新组件也要写入 1
+	const TArray<float> & Data = MeshComponent->GetCustomPrimitiveData().Data;
+	if ( Data.IsValidIndex(TerrainLODFadeDataIndex) && Data[TerrainLODFadeDataIndex] == Value )
+	{
+		return;
+	}
+	MeshComponent->SetCustomPrimitiveDataFloat(TerrainLODFadeDataIndex, Value);
+}
+
+// 摄像机所在格子
+FIntVector UDTTerrainComponent::GetCameraCell(const FVector& Location)
+{
+	return FIntVector( FMath::FloorToInt(Location.X / TerrainCameraCell), FMath::FloorToInt(Location.Y / TerrainCameraCell), FMath::FloorToInt(Location.Z / TerrainCameraCell) );
+}
+
+// 地块坐标转换为地块中心
+FInt64Vector2 UDTTerrainComponent::GetTileKey(int64 TileX, int64 TileY)
+{
+	return FInt64Vector2( TerrainSizeBeginX + TileX * TerrainInterval + TerrainInterval / 2, TerrainSizeBeginY + TileY * TerrainInterval + TerrainInterval / 2 );
+}
+
+// 添加范围内的地块
+void UDTTerrainComponent::AddTilesInRange(const FVector& Location, int64 Radius, TSet<FInt64Vector2>& SetTile) const
+{
+	// 地块坐标范围, 限制在地图内
+	const int64 TileCountX = (TerrainSizeEndX - TerrainSizeBeginX) / TerrainInterval;
+	const int64 TileCountY = (TerrainSizeEndY - TerrainSizeBeginY) / TerrainInterval;
+	const int64 MinX = FMath::Max<int64>( FMath::FloorToInt64((Location.X - Radius - TerrainSizeBeginX) / TerrainInterval), 0 );
+	const int64 MinY = FMath::Max<int64>( FMath::FloorToInt64((Location.Y - Radius - TerrainSizeBeginY) / TerrainInterval), 0 );
+	const int64 MaxX = FMath::Min<int64>( FMath::FloorToInt64((Location.X + Radius - TerrainSizeBeginX) / TerrainInterval), TileCountX - 1 );
+	const int64 MaxY = FMath::Min<int64>( FMath::FloorToInt64((Location.Y + Radius - TerrainSizeBeginY) / TerrainInterval), TileCountY - 1 );
+	for ( int64 TileX = MinX; TileX <= MaxX; ++TileX )
+	{
+		for ( int64 TileY = MinY; TileY <= MaxY; ++TileY )
+		{
+			SetTile.Add(GetTileKey(TileX, TileY));
 		}
 	}
 }
@@ -93,6 +383,49 @@ void UDTTerrainComponent::DestroyMeshComponent(UMeshComponent*& MeshLOD)
 	}
 }
 
+// 隐藏组件并延迟到预算内回收
+void UDTTerrainComponent::ReleaseMeshComponent(UMeshComponent*& MeshLOD)
+{
+	if ( MeshLOD != nullptr )
+	{
+		MeshLOD->SetHiddenInGame(true);
+		m_ArrayRecycle.Add(MeshLOD);
+		MeshLOD = nullptr;
+	}
+}
+
+// 取出回收的组件
+UDTHMeshComponent* UDTTerrainComponent::AcquireMeshComponent()
+{
+	if ( m_ArrayPool.Num() )
+	{
+		return m_ArrayPool.Pop(false);
+	}
+
+	// 名字不再和区域对应, 组件会在不同区域之间重复使用
+	UDTHMeshComponent* HMeshComponent = NewObject<UDTHMeshComponent>(this, UDTHMeshComponent::StaticClass(), MakeUniqueObjectName(this, UDTHMeshComponent::StaticClass(), TEXT("PMC")));
+	HMeshComponent->SetupAttachment(this);
+	HMeshComponent->RegisterComponent();
+	HMeshComponent->SetMaterial(0, m_Material);
+	UDTTools::ComponentAddsCollisionChannel(HMeshComponent);
+	return HMeshComponent;
+}
+
+// 清空组件放回池
+void UDTTerrainComponent::RecycleMeshComponent(UMeshComponent*& MeshLOD)
+{
+	UDTHMeshComponent* HMeshComponent = Cast<UDTHMeshComponent>(MeshLOD);
+	if ( HMeshComponent != nullptr && m_ArrayPool.Num() < TerrainMeshPoolSize )
+	{
+		// 释放缓冲和碰撞, 组件保持注册, 不重新创建渲染状态
+		HMeshComponent->ClearMesh();
+		m_ArrayPool.Add(HMeshComponent);
+		MeshLOD = nullptr;
+		return;
+	}
+	DestroyMeshComponent(MeshLOD);
+}
+
 void UDTTerrainComponent::GenerateTerrain()
 {
 	TArray<FVector2D> ArrayVector2D;
@@ -104,145 +437,523 @@ void UDTTerrainComponent::GenerateTerrain()
 			GenerateArea(X, Y, TerrainInterval, TerrainLODInterval2, nullptr);
 			GenerateArea(X, Y, TerrainInterval, TerrainLODIntervalMax, nullptr);
 
+			// 常驻LOD同时测量各LOD的几何偏差
+			FDTTerrainAreaData AreaData;
+			AreaData.TileKey = FInt64Vector2(X + TerrainInterval / 2, Y + TerrainInterval / 2);
+			AreaData.BeginX = X;
+			AreaData.BeginY = Y;
+			AreaData.Length = TerrainInterval;
+			AreaData.Interval = TerrainLODIntervalMax;
+			GenerateAreaData(AreaData);
+
 			FDTMeshLOD DTMeshLOD;
 			DTMeshLOD.MeshLOD1 = nullptr;
 			DTMeshLOD.MeshLOD2 = nullptr;
-			DTMeshLOD.MeshLODMax = GenerateArea(X, Y, TerrainInterval, TerrainLODIntervalMax);
+			DTMeshLOD.MeshLODMax = CreateMeshComponent(AreaData);
+			DTMeshLOD.MeshShow = DTMeshLOD.MeshLODMax;
+			DTMeshLOD.FadeBeginTime = 0.0;
+			DTMeshLOD.LODError2 = AreaData.LODError2;
+			DTMeshLOD.LODErrorMax = AreaData.LODErrorMax;
+			m_MaxLODError = FMath::Max(m_MaxLODError, AreaData.LODErrorMax);
 			m_MapMesh.Add(FInt64Vector2(X + TerrainInterval / 2, Y + TerrainInterval / 2), DTMeshLOD);
 		}
 	}
+	m_bFullUpdate = true;
 }
 
 UMeshComponent* UDTTerrainComponent::GenerateArea(int64 BeginX, int64 BeginY, int64 Length, int64 Interval)
 {
-	// 创建组件
-	UDTHMeshComponent* HMeshComponent = NewObject<UDTHMeshComponent>(this, UDTHMeshComponent::StaticClass(), *FString::Printf(TEXT("PMC_%I64d_%I64d_%I64d_%I64d"), BeginX, BeginY, Length, Interval));
-	HMeshComponent->SetupAttachment(this);
-	HMeshComponent->RegisterComponent();
-	HMeshComponent->SetMaterial(0, m_Material);
-	UDTTools::ComponentAddsCollisionChannel(HMeshComponent);
+	FDTTerrainAreaData AreaData;
+	AreaData.TileKey = FInt64Vector2(BeginX + Length / 2, BeginY + Length / 2);
+	AreaData.BeginX = BeginX;
+	AreaData.BeginY = BeginY;
+	AreaData.Length = Length;
+	AreaData.Interval = Interval;
+	GenerateAreaData(AreaData);
+	return CreateMeshComponent(AreaData);
+}
 
-	GenerateArea(BeginX, BeginY, Length, Interval,
-[this, HMeshComponent]
-		(const TArray<FVector> & ArrayPoints, const TArray<FVector> & ArrayNormals, const TArray<int32> & ArrayTriangles, const TArray<FVector2D> & ArrayUVs)
+void UDTTerrainComponent::GenerateArea(int64 BeginX, int64 BeginY, int64 Length, int64 Interval, TFunction<void(TConstArrayView<FVector>, TConstArrayView<FVector>, TConstArrayView<int32>, TConstArrayView<FVector2D>)> Function)
+{
+	FDTTerrainAreaData AreaData;
+	AreaData.TileKey = FInt64Vector2(BeginX + Length / 2, BeginY + Length / 2);
+	AreaData.BeginX = BeginX;
+	AreaData.BeginY = BeginY;
+	AreaData.Length = Length;
+	AreaData.Interval = Interval;
+	GenerateAreaData(AreaData);
+
+	if ( Function != nullptr )
 	{
-		HMeshComponent->SetMesh(ArrayPoints, ArrayTriangles, ArrayNormals, ArrayUVs);
-	});
-	
+		Function(AreaData.Points, AreaData.Normals, AreaData.Triangles, AreaData.UVs);
+	}
+}
+
+// 使用区域数据创建组件
+UMeshComponent* UDTTerrainComponent::CreateMeshComponent(const FDTTerrainAreaData& AreaData, bool bHidden)
+{
+	// 取出组件, 点使用地形组件的本地坐标, 组件不需要重新设置变换
+	UDTHMeshComponent* HMeshComponent = AcquireMeshComponent();
+
+	// 只有常驻LOD带碰撞, 使用碰撞格点, 其他LOD不生成碰撞
+	if ( AreaData.CollisionPoints.Num() )
+	{
+		HMeshComponent->SetCollisionLattice(AreaData.CollisionPoints, AreaData.CollisionTriangles);
+	}
+	else
+	{
+		HMeshComponent->SetCollisionSource(EDTMeshCollisionSource::None);
+	}
+	HMeshComponent->SetMesh(AreaData.Points, AreaData.Triangles, AreaData.Normals, AreaData.UVs);
+	SetFadeValue(HMeshComponent, 1.0f);
+	HMeshComponent->SetHiddenInGame(bHidden);
 	return HMeshComponent;
 }
 
-void UDTTerrainComponent::GenerateArea(int64 BeginX, int64 BeginY, int64 Length, int64 Interval, TFunction<void(const TArray<FVector>&, const TArray<FVector>&, const TArray<int32>&, const TArray<FVector2D>&)> Function)
+// 生成区域数据
+void UDTTerrainComponent::GenerateAreaData(FDTTerrainAreaData& AreaData)
 {
+	const int64 BeginX = AreaData.BeginX;
+	const int64 BeginY = AreaData.BeginY;
+	const int64 Length = AreaData.Length;
+	const int64 Interval = AreaData.Interval;
+
 	// 模型数据
-	TArray<FVector>		ArrayPoints;						// 点位置数据
-	TArray<FVector>		ArrayNormals;						// 点法线数据
-	TArray<int32>		ArrayTriangles;						// 三角面索引
-	TArray<FVector2D>	ArrayUVs;							// UV
-
-	// 文件路径
-	FString FilePoints = FPaths::Combine(FPlatformProcess::UserTempDir(), FString::Printf(TEXT("35DE6282C99784004365C4756D7BDAE6-%I64d-%I64d-%I64d-%I64d.Points"), BeginX, BeginY, Length, Interval));
-	FString FileNormals = FPaths::Combine(FPlatformProcess::UserTempDir(), FString::Printf(TEXT("35DE6282C99784004365C4756D7BDAE6-%I64d-%I64d-%I64d-%I64d.Normals"), BeginX, BeginY, Length, Interval));
-	FString FileTriangles = FPaths::Combine(FPlatformProcess::UserTempDir(), FString::Printf(TEXT("35DE6282C99784004365C4756D7BDAE6-%I64d-%I64d-%I64d-%I64d.Triangles"), BeginX, BeginY, Length, Interval));
-	FString FileUVs = FPaths::Combine(FPlatformProcess::UserTempDir(), FString::Printf(TEXT("35DE6282C99784004365C4756D7BDAE6-%I64d-%I64d-%I64d-%I64d.UVs"), BeginX, BeginY, Length, Interval));
-
-	// 重新读取数据
-	LOAD_FILE(FVector, FilePoints, ArrayPoints);
-	LOAD_FILE(FVector, FileNormals, ArrayNormals);
-	LOAD_FILE(int32, FileTriangles, ArrayTriangles);
-	LOAD_FILE(FVector2D, FileUVs, ArrayUVs);
-
-	// 读取失败
-	if ( ArrayPoints.Num() == 0 || ArrayNormals.Num() == 0 || ArrayUVs.Num() == 0 || ArrayTriangles.Num() == 0
-		|| ArrayPoints.Num() != ArrayNormals.Num() || ArrayPoints.Num() != ArrayUVs.Num()
-		|| ArrayTriangles.Num() % 3 != 0 )
-	{
-		// 清空无效数据
-		ArrayPoints.Empty();
-		ArrayNormals.Empty();
-		ArrayTriangles.Empty();
-		ArrayUVs.Empty();
-
-		// 生成点数据
-		TArray<FVector2D> ArrayVector2D;
-
-		ArrayVector2D.Add( FVector2D( BeginX, BeginY ) );
-		ArrayVector2D.Add( FVector2D( BeginX, BeginY + Length ) );
-		ArrayVector2D.Add( FVector2D( BeginX + Length , BeginY + Length ) );
-		ArrayVector2D.Add( FVector2D( BeginX + Length , BeginY ) );
-		for ( int64 X = BeginX + TerrainLODIntervalMin; X <= BeginX + Length - TerrainLODIntervalMin; X += TerrainLODIntervalMin )
-		{
-			ArrayVector2D.Add( FVector2D( X, BeginY ) );
-			ArrayVector2D.Add( FVector2D( X, BeginY + Length ) );
-		}
-		for ( int64 Y = BeginY + TerrainLODIntervalMin; Y <= BeginY + Length - TerrainLODIntervalMin; Y += TerrainLODIntervalMin )
-		{
-			ArrayVector2D.Add( FVector2D( BeginX, Y ) );
-			ArrayVector2D.Add( FVector2D( BeginX + Length, Y ) );
+	TArray<FVector>	&	ArrayPoints = AreaData.Points;				// 点位置数据
+	TArray<FVector>	&	ArrayNormals = AreaData.Normals;			// 点法线数据
+	TArray<int32> &		ArrayTriangles = AreaData.Triangles;		// 三角面索引
+	TArray<FVector2D> &	ArrayUVs = AreaData.UVs;					// UV
+
+	// 碰撞格点不进缓存, 从高程缓存直接生成
+	if ( Interval == TerrainCollisionLODInterval )
+	{
+		GenerateAreaCollision(AreaData);
+		MeasureAreaError(AreaData);
+	}
+
+	// 缓存文件, 紧凑编码, 读取时解码
+	const FString FileCache = FPaths::Combine(FPlatformProcess::UserTempDir(), FString::Printf(TEXT("35DE6282C99784004365C4756D7BDAE6-%I64d-%I64d-%I64d-%I64d.dtmesh"), BeginX, BeginY, Length, Interval));
+	const uint64 ParamHash = GetAreaHash(AreaData);
+	if ( LoadAreaCache(AreaData, FileCache, ParamHash) )
+	{
+		AppendAreaSkirt(AreaData);
+		return;
+	}
+
+	// 生成点数据和三角面, 边界使用地块自己的间隔, 不同LOD之间的裂缝由裙边遮住
+	TArray<FVector2D> ArrayVector2D;
+	UDTTools::TriangulateBorderedGrid(BeginX, BeginY, Length, Interval, Interval, ArrayVector2D, ArrayTriangles);
+	if ( AreaData.bCancel )
+	{
+		return;
+	}
+
+	// 读取高程, 相邻地块和不同LOD的共享点从同一个分块读取, 高程一致
+	TArray<float> ArrayElevation;
+	m_ElevationCache->GetElevations(ArrayVector2D, ArrayElevation);
+
+	// 生成模型数据
+	ArrayPoints.Reserve(ArrayVector2D.Num());
+	ArrayUVs.Reserve(ArrayVector2D.Num());
+	for ( int32 Index = 0; Index < ArrayVector2D.Num(); ++Index )
+	{
+		const FVector2D & Vector2D = ArrayVector2D[Index];
+		ArrayPoints.Add(FVector(Vector2D.X, Vector2D.Y, FDTMeshCacheTile::SnapHeight(ArrayElevation[Index] * TerrainElevationScale, TerrainHeightQuantum)));
+
+		const FVector2D UV((Vector2D.X - static_cast<double>(TerrainSizeBeginX)) / static_cast<double>(TerrainSizeEndX - TerrainSizeBeginX),
+							(Vector2D.Y - static_cast<double>(TerrainSizeBeginX)) / static_cast<double>(TerrainSizeEndY - TerrainSizeBeginY));
+		ArrayUVs.Add( UV );
+	}
+
+	// 计算点法线
+	UDTTools::CalculateVertexNormals(ArrayPoints, ArrayTriangles, ArrayNormals);
+
+	// 保存文件
+	FDTMeshCacheWriter CacheWriter;
+	if ( CacheWriter.AddTile(GetAreaTile(AreaData), AreaData.Points, AreaData.Normals) )
+	{
+		CacheWriter.Save(FileCache, ParamHash);
+	}
+
+	// 裙边不进缓存
+	AppendAreaSkirt(AreaData);
+}
+
+// 地块边界添加裙边
+void UDTTerrainComponent::AppendAreaSkirt(FDTTerrainAreaData& AreaData) const
+{
+	static_assert( TerrainLODInterval2 % TerrainLODIntervalMin == 0 && TerrainLODIntervalMax % TerrainLODIntervalMin == 0, "LOD lattice must lie on the elevation lattice" );
+
+	// 只处理规则网格, 点索引为 X * Count + Y
+	const int32 Count = static_cast<int32>(AreaData.Length / AreaData.Interval) + 1;
+	if ( AreaData.Points.Num() != Count * Count || AreaData.Normals.Num() != AreaData.Points.Num() || AreaData.UVs.Num() != AreaData.Points.Num() )
+	{
+		return;
+	}
+
+	// 每条边按最小间隔采样, 边的方向和向外方向
+	const int32 FineCount = static_cast<int32>(AreaData.Length / TerrainLODIntervalMin) + 1;
+	const int64 EndX = AreaData.BeginX + AreaData.Length;
+	const int64 EndY = AreaData.BeginY + AreaData.Length;
+	const FInt64Vector2 EdgeBegin[4] = { { AreaData.BeginX, AreaData.BeginY }, { EndX, AreaData.BeginY }, { AreaData.BeginX, EndY }, { AreaData.BeginX, AreaData.BeginY } };
+	const FInt64Vector2 EdgeStep[4] = { { 1, 0 }, { 0, 1 }, { 1, 0 }, { 0, 1 } };
+	const FVector EdgeOutward[4] = { -FVector::YAxisVector, FVector::XAxisVector, FVector::YAxisVector, -FVector::XAxisVector };
+	TArray<FVector2D> ArrayVector2D;
+	ArrayVector2D.SetNumUninitialized(FineCount * 4);
+	for ( int32 Edge = 0; Edge < 4; ++Edge )
+	{
+		for ( int32 Index = 0; Index < FineCount; ++Index )
+		{
+			ArrayVector2D[Edge * FineCount + Index] = FVector2D(EdgeBegin[Edge].X + EdgeStep[Edge].X * Index * TerrainLODIntervalMin, EdgeBegin[Edge].Y + EdgeStep[Edge].Y * Index * TerrainLODIntervalMin);
 		}
-		
-		for ( int64 X = BeginX + Interval; X <= BeginX + Length - Interval; X += Interval )
+	}
+	TArray<float> ArrayElevation;
+	m_ElevationCache->GetElevations(ArrayVector2D, ArrayElevation);
+
+	// 裂缝最大为最细的边和较粗LOD的边之间的高度差, 两侧地块采样相同, 裙边深度一致
+	double EdgeDepth[4] = { 0.0, 0.0, 0.0, 0.0 };
+	for ( int32 Edge = 0; Edge < 4; ++Edge )
+	{
+		auto Height = [&](int32 Index) { return FDTMeshCacheTile::SnapHeight(ArrayElevation[Edge * FineCount + Index] * TerrainElevationScale, TerrainHeightQuantum); };
+		for ( const int64 Interval : { TerrainLODInterval2, TerrainLODIntervalMax } )
 		{
-			for ( int64 Y = BeginY + Interval; Y <= BeginY + Length - Interval; Y += Interval )
+			const int32 Step = static_cast<int32>(Interval / TerrainLODIntervalMin);
+			for ( int32 Index = 0; Index < FineCount; ++Index )
 			{
-				ArrayVector2D.Add( FVector2D( X, Y ) );
+				const int32 Index0 = FMath::Min(Index / Step * Step, FineCount - 1 - Step);
+				const double Alpha = static_cast<double>(Index - Index0) / Step;
+				EdgeDepth[Edge] = FMath::Max(EdgeDepth[Edge], FMath::Abs(Height(Index) - FMath::Lerp(Height(Index0), Height(Index0 + Step), Alpha)));
 			}
 		}
+		EdgeDepth[Edge] += TerrainSkirtMargin;
+	}
 
-		// 生成三角面
-		UE::Geometry::FDelaunay2 Delaunay;
-		Delaunay.Triangulate(ArrayVector2D);
-		TArray<UE::Geometry::FIndex3i> ArrayIndex = Delaunay.GetTriangles();
-    
-		// 关联索引
-		TMap<int, TArray<UE::Geometry::FIndex3i>> MapIndex;
+	// 边界点向下复制, 法线和UV与边界点相同
+	auto GetEdgeIndex = [Count](int32 Edge, int32 Index)
+	{
+		switch ( Edge )
+		{
+		case 0:  return Index * Count;
+		case 1:  return (Count - 1) * Count + Index;
+		case 2:  return Index * Count + Count - 1;
+		default: return Index;
+		}
+	};
+	AreaData.Points.Reserve(AreaData.Points.Num() + Count * 4);
+	AreaData.Normals.Reserve(AreaData.Normals.Num() + Count * 4);
+	AreaData.UVs.Reserve(AreaData.UVs.Num() + Count * 4);
+	AreaData.Triangles.Reserve(AreaData.Triangles.Num() + (Count - 1) * 4 * 6);
+	for ( int32 Edge = 0; Edge < 4; ++Edge )
+	{
+		const int32 SkirtBase = AreaData.Points.Num();
+		for ( int32 Index = 0; Index < Count; ++Index )
+		{
+			const int32 TopIndex = GetEdgeIndex(Edge, Index);
+			AreaData.Points.Add(AreaData.Points[TopIndex] - FVector(0.0, 0.0, EdgeDepth[Edge]));
+			AreaData.Normals.Add(AreaData.Normals[TopIndex]);
+			AreaData.UVs.Add(AreaData.UVs[TopIndex]);
+		}
 
-		// 生成模型数据
-		for ( const FVector2D & Vector2D : ArrayVector2D )
+		// 三角面法线与 CalculateVertexNormals 一致, 朝向地块外侧
+		const FVector & Point0 = AreaData.Points[GetEdgeIndex(Edge, 0)];
+		const FVector & Point1 = AreaData.Points[GetEdgeIndex(Edge, 1)];
+		const FVector & Point2 = AreaData.Points[SkirtBase + 1];
+		const bool bFlip = FVector::DotProduct((Point2 - Point0) ^ (Point1 - Point0), EdgeOutward[Edge]) < 0.0;
+		for ( int32 Index = 0; Index < Count - 1; ++Index )
 		{
-			double Elevation = 0.0;
-			FInt64Vector2 PointKey(Vector2D.X, Vector2D.Y);
-			if ( double * pFindElevation = m_MapElevation.Find(PointKey) )
-			{
-				Elevation = *pFindElevation;
-			}
-			else
+			const int32 Top0 = GetEdgeIndex(Edge, Index);
+			const int32 Top1 = GetEdgeIndex(Edge, Index + 1);
+			const int32 Bottom0 = SkirtBase + Index;
+			const int32 Bottom1 = SkirtBase + Index + 1;
+			const int32 Quad[2][6] = { { Top0, Top1, Bottom1, Top0, Bottom1, Bottom0 }, { Top0, Bottom1, Top1, Top0, Bottom0, Bottom1 } };
+			AreaData.Triangles.Append(Quad[bFlip ? 1 : 0], 6);
+		}
+	}
+}
+
+// 生成区域碰撞格点
+void UDTTerrainComponent::GenerateAreaCollision(FDTTerrainAreaData& AreaData)
+{
+	static_assert( TerrainCollisionInterval % TerrainLODIntervalMin == 0, "Collision lattice must lie on the elevation lattice" );
+
+	// 规则格点, 点索引为 X * Count + Y
+	const int32 Count = static_cast<int32>(AreaData.Length / TerrainCollisionInterval) + 1;
+	TArray<FVector2D> ArrayVector2D;
+	ArrayVector2D.SetNumUninitialized(Count * Count);
+	for ( int32 X = 0; X < Count; ++X )
+	{
+		for ( int32 Y = 0; Y < Count; ++Y )
+		{
+			ArrayVector2D[X * Count + Y] = FVector2D(AreaData.BeginX + X * TerrainCollisionInterval, AreaData.BeginY + Y * TerrainCollisionInterval);
+		}
+	}
+
+	// 高程与渲染点使用同一个缓存, 格点重合处高度一致
+	TArray<float> ArrayElevation;
+	m_ElevationCache->GetElevations(ArrayVector2D, ArrayElevation);
+	AreaData.CollisionPoints.SetNumUninitialized(ArrayVector2D.Num());
+	for ( int32 Index = 0; Index < ArrayVector2D.Num(); ++Index )
+	{
+		const FVector2D & Vector2D = ArrayVector2D[Index];
+		AreaData.CollisionPoints[Index] = FVector(Vector2D.X, Vector2D.Y, FDTMeshCacheTile::SnapHeight(ArrayElevation[Index] * TerrainElevationScale, TerrainHeightQuantum));
+	}
+	AreaData.CollisionTriangles.Empty();
+	UDTTools::TriangulateGrid(Count, Count, AreaData.CollisionTriangles);
+}
+
+// 以LOD 1层格点为参照测量各LOD的几何偏差
+void UDTTerrainComponent::MeasureAreaError(FDTTerrainAreaData& AreaData) const
+{
+	static_assert( TerrainLODInterval1 == TerrainLODIntervalMin, "LOD 1 is the reference lattice" );
+	static_assert( TerrainLODInterval2 % TerrainLODIntervalMin == 0 && TerrainLODIntervalMax % TerrainLODIntervalMin == 0, "LOD lattice must lie on the reference lattice" );
+	static_assert( TerrainInterval % TerrainLODInterval2 == 0 && TerrainInterval % TerrainLODIntervalMax == 0, "LOD lattice must cover the whole tile" );
+
+	// 最细的LOD 1层格点作为参照, 高度与渲染点从同一个高程缓存读取, 点索引为 X * Count + Y
+	const int32 Count = static_cast<int32>(AreaData.Length / TerrainLODIntervalMin) + 1;
+	TArray<FVector2D> ArrayVector2D;
+	ArrayVector2D.SetNumUninitialized(Count * Count);
+	for ( int32 X = 0; X < Count; ++X )
+	{
+		for ( int32 Y = 0; Y < Count; ++Y )
+		{
+			ArrayVector2D[X * Count + Y] = FVector2D(AreaData.BeginX + X * TerrainLODIntervalMin, AreaData.BeginY + Y * TerrainLODIntervalMin);
+		}
+	}
+	TArray<float> ArrayElevation;
+	m_ElevationCache->GetElevations(ArrayVector2D, ArrayElevation);
+	if ( AreaData.bCancel )
+	{
+		return;
+	}
+	TArray<double> ArrayHeight;
+	ArrayHeight.SetNumUninitialized(ArrayElevation.Num());
+	for ( int32 Index = 0; Index < ArrayElevation.Num(); ++Index )
+	{
+		ArrayHeight[Index] = FDTMeshCacheTile::SnapHeight(ArrayElevation[Index] * TerrainElevationScale, TerrainHeightQuantum);
+	}
+
+	auto Height = [&ArrayHeight, Count](int32 X, int32 Y) { return ArrayHeight[X * Count + Y]; };
+	auto Measure = [&Height, Count](int64 Interval)
+	{
+		// 三角面和 TriangulateGrid 一致, 对角线为 00-11
+		const int32 Step = static_cast<int32>(Interval / TerrainLODIntervalMin);
+		const int32 Cells = (Count - 1) / Step;
+		double MaxError = 0.0;
+		for ( int32 X = 0; X < Count; ++X )
+		{
+			for ( int32 Y = 0; Y < Count; ++Y )
 			{
-				// Elevation = FMath::RandHelper(5000);
-				Elevation = m_FastNoiseWrapper->GetNoise2D(PointKey.X, PointKey.Y) * 500.0;
-				m_MapElevation.Add(PointKey, Elevation);
+				const int32 X0 = FMath::Min(X / Step, Cells - 1) * Step;
+				const int32 Y0 = FMath::Min(Y / Step, Cells - 1) * Step;
+				const double U = static_cast<double>(X - X0) / Step;
+				const double V = static_cast<double>(Y - Y0) / Step;
+				const double H00 = Height(X0, Y0);
+				const double H10 = Height(X0 + Step, Y0);
+				const double H01 = Height(X0, Y0 + Step);
+				const double H11 = Height(X0 + Step, Y0 + Step);
+				const double Interpolated = U >= V ? H00 + U * (H10 - H00) + V * (H11 - H10) : H00 + V * (H01 - H00) + U * (H11 - H01);
+				MaxError = FMath::Max(MaxError, FMath::Abs(Height(X, Y) - Interpolated));
 			}
-			ArrayPoints.Add(FVector(Vector2D.X, Vector2D.Y, Elevation));
+		}
+		return MaxError;
+	};
+	AreaData.LODError2 = Measure(TerrainLODInterval2);
+	AreaData.LODErrorMax = FMath::Max(Measure(TerrainLODIntervalMax), AreaData.LODError2);
+}
 
-			const FVector2D UV((Vector2D.X - static_cast<double>(TerrainSizeBeginX)) / static_cast<double>(TerrainSizeEndX - TerrainSizeBeginX),
-								(Vector2D.Y - static_cast<double>(TerrainSizeBeginX)) / static_cast<double>(TerrainSizeEndY - TerrainSizeBeginY));
-			ArrayUVs.Add( UV );
+// 读取并解码区域缓存
+bool UDTTerrainComponent::LoadAreaCache(FDTTerrainAreaData& AreaData, const FString& FileCache, uint64 ParamHash) const
+{
+	const FDTMeshCachePtr Cache = FDTMeshCache::Load(FileCache, ParamHash);
+	if ( !Cache.IsValid() || !Cache->DecodeTile(AreaData.Points, AreaData.Normals, AreaData.Triangles, AreaData.UVs) )
+	{
+		AreaData.Points.Empty();
+		AreaData.Normals.Empty();
+		AreaData.Triangles.Empty();
+		AreaData.UVs.Empty();
+		return false;
+	}
+	return true;
+}
+
+// 区域生成参数哈希
+uint64 UDTTerrainComponent::GetAreaHash(const FDTTerrainAreaData& AreaData) const
+{
+	FDTMeshCacheHash Hash;
+	Hash << AreaData.BeginX << AreaData.BeginY << AreaData.Length << AreaData.Interval << GetAreaTile(AreaData).BorderInterval;
+	Hash << TerrainLODIntervalMin << TerrainSizeBeginX << TerrainSizeBeginY << TerrainSizeEndX << TerrainSizeEndY << TerrainElevationScale << TerrainHeightQuantum;
+	Hash << m_FastNoiseWrapper->IsInitialized() << m_FastNoiseWrapper->GetNoiseType() << m_FastNoiseWrapper->GetSeed() << m_FastNoiseWrapper->GetFrequency()
+		<< m_FastNoiseWrapper->GetInterpolation() << m_FastNoiseWrapper->GetFractalType() << m_FastNoiseWrapper->GetOctaves() << m_FastNoiseWrapper->GetLacunarity()
+		<< m_FastNoiseWrapper->GetGain() << m_FastNoiseWrapper->GetCellularJitter() << m_FastNoiseWrapper->GetDistanceFunction() << m_FastNoiseWrapper->GetReturnType();
+	return Hash.Get();
+}
+
+// 区域紧凑编码参数
+FDTMeshCacheTile UDTTerrainComponent::GetAreaTile(const FDTTerrainAreaData& AreaData)
+{
+	FDTMeshCacheTile Tile;
+	FMemory::Memzero(Tile);
+	Tile.BeginX = AreaData.BeginX;
+	Tile.BeginY = AreaData.BeginY;
+	Tile.Length = AreaData.Length;
+	Tile.Interval = AreaData.Interval;
+	Tile.BorderInterval = AreaData.Interval;
+	Tile.HeightQuantum = TerrainHeightQuantum;
+	Tile.UVOriginX = static_cast<double>(TerrainSizeBeginX);
+	Tile.UVOriginY = static_cast<double>(TerrainSizeBeginX);
+	Tile.UVSizeX = static_cast<double>(TerrainSizeEndX - TerrainSizeBeginX);
+	Tile.UVSizeY = static_cast<double>(TerrainSizeEndY - TerrainSizeBeginY);
+	return Tile;
+}
+
+// 计算地块优先级
+double UDTTerrainComponent::GetPriority(const FInt64Vector2& TileKey) const
+{
+	// 距离越近越优先, 视线前方的地块优先于身后的地块
+	const FVector ToTile = FVector(TileKey.X, TileKey.Y, 0.0) - m_CameraLocation;
+	const double Distance = ToTile.Size();
+	const double Facing = Distance > UE_KINDA_SMALL_NUMBER ? FVector::DotProduct(ToTile / Distance, m_CameraDirection) : 1.0;
+	return Distance * (1.5 - 0.5 * Facing);
+}
+
+// 请求异步生成区域
+void UDTTerrainComponent::RequestArea(const FInt64Vector2& TileKey, FDTMeshLOD& Mesh, int64 Interval)
+{
+	// 已经在生成
+	if ( Mesh.PendingArea.IsValid() && Mesh.PendingArea->Interval == Interval )
+	{
+		return;
+	}
+
+	// 取消之前的请求
+	CancelArea(Mesh);
+
+	FDTTerrainAreaDataPtr AreaData = MakeShared<FDTTerrainAreaData, ESPMode::ThreadSafe>();
+	AreaData->TileKey = TileKey;
+	AreaData->BeginX = TileKey.X - TerrainInterval / 2;
+	AreaData->BeginY = TileKey.Y - TerrainInterval / 2;
+	AreaData->Length = TerrainInterval;
+	AreaData->Interval = Interval;
+	Mesh.PendingArea = AreaData;
+	m_ArrayRequest.Add(AreaData);
+}
+
+// 取消正在生成的区域
+void UDTTerrainComponent::CancelArea(FDTMeshLOD& Mesh)
+{
+	if ( Mesh.PendingArea.IsValid() )
+	{
+		Mesh.PendingArea->bCancel = true;
+		Mesh.PendingArea.Reset();
+	}
+}
+
+// 启动等待中的请求
+void UDTTerrainComponent::LaunchRequests()
+{
+	// 清理完成的任务和取消的请求
+	m_ArrayTask.RemoveAllSwap([](const UE::Tasks::FTask & Task) { return Task.IsCompleted(); });
+	m_ArrayRequest.RemoveAllSwap([](const FDTTerrainAreaDataPtr & AreaData) { return AreaData->bCancel.load(); });
+
+	// 按当前摄像机重新排序
+	for ( const FDTTerrainAreaDataPtr & AreaData : m_ArrayRequest )
+	{
+		AreaData->Priority = GetPriority(AreaData->TileKey);
+	}
+	m_ArrayRequest.Sort([](const FDTTerrainAreaDataPtr & A, const FDTTerrainAreaDataPtr & B) { return A->Priority < B->Priority; });
+
+	int32 RequestIndex = 0;
+	for ( ; RequestIndex < m_ArrayRequest.Num() && m_NumTaskInFlight < TerrainMaxTaskInFlight; ++RequestIndex )
+	{
+		FDTTerrainAreaDataPtr AreaData = m_ArrayRequest[RequestIndex];
+		++m_NumTaskInFlight;
+		m_ArrayTask.Add(UE::Tasks::Launch(UE_SOURCE_LOCATION, [this, AreaData]()
+		{
+			GenerateAreaData(*AreaData);
+			m_QueueFinish.Enqueue(AreaData);
+		}));
+	}
+	m_ArrayRequest.RemoveAt(0, RequestIndex);
+}
+
+// 接收已完成的区域
+void UDTTerrainComponent::ReceiveFinished()
+{
+	FDTTerrainAreaDataPtr AreaData;
+	while ( m_QueueFinish.Dequeue(AreaData) )
+	{
+		--m_NumTaskInFlight;
+		if ( !AreaData->bCancel )
+		{
+			m_ArrayReady.Add(AreaData);
 		}
-		for ( const UE::Geometry::FIndex3i & Index3i : ArrayIndex )
+	}
+}
+
+// 在预算内创建和销毁组件
+void UDTTerrainComponent::ProcessReady(double BeginTime)
+{
+	const double EndTime = BeginTime + m_FrameBudgetMs / 1000.0;
+
+	// 优先创建离摄像机近的区域, 每帧至少处理一个
+	m_ArrayReady.RemoveAllSwap([](const FDTTerrainAreaDataPtr & AreaData) { return AreaData->bCancel.load(); });
+	for ( const FDTTerrainAreaDataPtr & AreaData : m_ArrayReady )
+	{
+		AreaData->Priority = GetPriority(AreaData->TileKey);
+	}
+	m_ArrayReady.Sort([](const FDTTerrainAreaDataPtr & A, const FDTTerrainAreaDataPtr & B) { return A->Priority < B->Priority; });
+
+	int32 ReadyIndex = 0;
+	for ( ; ReadyIndex < m_ArrayReady.Num(); ++ReadyIndex )
+	{
+		if ( ReadyIndex > 0 && FPlatformTime::Seconds() >= EndTime )
 		{
-			ArrayTriangles.Add( Index3i.C );
-			ArrayTriangles.Add( Index3i.B );
-			ArrayTriangles.Add( Index3i.A );
-			MapIndex.FindOrAdd(Index3i.C).Add(Index3i);
-			MapIndex.FindOrAdd(Index3i.B).Add(Index3i);
-			MapIndex.FindOrAdd(Index3i.A).Add(Index3i);
+			break;
 		}
-		for (int nPointIndex = 0; nPointIndex < ArrayPoints.Num(); nPointIndex++)
+		
+		// 只接收仍然需要的LOD
+		const FDTTerrainAreaDataPtr & AreaData = m_ArrayReady[ReadyIndex];
+		FDTMeshLOD * Mesh = m_MapMesh.Find(AreaData->TileKey);
+		if ( Mesh == nullptr || Mesh->PendingArea != AreaData )
 		{
-			ArrayNormals.Add( UDTTools::CalculateVertexNormal(ArrayPoints, ArrayTriangles, MapIndex, nPointIndex) );
+			continue;
 		}
+		Mesh->PendingArea.Reset();
+		m_SetDirty.Add(AreaData->TileKey);
 
-		// 保存文件
-		FFileHelper::SaveArrayToFile(TArray64<uint8>((uint8*)ArrayPoints.GetData(), ArrayPoints.Num() * ArrayPoints.GetTypeSize()), *FilePoints);
-		FFileHelper::SaveArrayToFile(TArray64<uint8>((uint8*)ArrayNormals.GetData(), ArrayNormals.Num() * ArrayNormals.GetTypeSize()), *FileNormals);
-		FFileHelper::SaveArrayToFile(TArray64<uint8>((uint8*)ArrayTriangles.GetData(), ArrayTriangles.Num() * ArrayTriangles.GetTypeSize()), *FileTriangles);
-		FFileHelper::SaveArrayToFile(TArray64<uint8>((uint8*)ArrayUVs.GetData(), ArrayUVs.Num() * ArrayUVs.GetTypeSize()), *FileUVs);
+		UMeshComponent *& MeshLOD = AreaData->Interval == TerrainLODInterval1 ? Mesh->MeshLOD1 : Mesh->MeshLOD2;
+		if ( MeshLOD == nullptr )
+		{
+			// 先隐藏, 更新地块时再淡入
+			MeshLOD = CreateMeshComponent(*AreaData, true);
+		}
 	}
+	m_ArrayReady.RemoveAt(0, ReadyIndex);
 
-	if ( Function != nullptr )
+	// 剩余预算回收组件
+	int32 RecycleIndex = 0;
+	for ( ; RecycleIndex < m_ArrayRecycle.Num(); ++RecycleIndex )
 	{
-		Function(ArrayPoints, ArrayNormals, ArrayTriangles, ArrayUVs);
+		if ( RecycleIndex > 0 && FPlatformTime::Seconds() >= EndTime )
+		{
+			break;
+		}
+		RecycleMeshComponent(m_ArrayRecycle[RecycleIndex]);
 	}
+	m_ArrayRecycle.RemoveAt(0, RecycleIndex);
+}
+
+// 等待所有任务完成
+void UDTTerrainComponent::WaitAllTasks()
+{
+	UE::Tasks::Wait(m_ArrayTask);
+	m_ArrayTask.Empty();
+	m_ArrayRequest.Empty();
+	m_ArrayReady.Empty();
+
+	FDTTerrainAreaDataPtr AreaData;
+	while ( m_QueueFinish.Dequeue(AreaData) ) {}
+	m_NumTaskInFlight = 0;
 }
 
 
@@ -5,10 +5,44 @@
 #include "CoreMinimal.h"
 #include "Components/SceneComponent.h"
 #include "Components/MeshComponent.h"
+#include "Containers/Queue.h"
+#include "Tasks/Task.h"
 #include "FastNoiseWrapper.h"
+#include "DTElevationCache.h"
+#include "DTModel/DTTools/DTMeshCache.h"
 #include "DTTerrainComponent.generated.h"
 
 class UFastNoiseWrapper;
+class UDTHMeshComponent;
+
+// 地形区域数据
+struct FDTTerrainAreaData
+{
+	FInt64Vector2									TileKey;				// 所属地块
+	int64											BeginX;					// 起点 X
+	int64											BeginY;					// 起点 Y
+	int64											Length;					// 边长
+	int64											Interval;				// 间隔
+	double											Priority = 0.0;			// 优先级, 越小越优先
+	std::atomic<bool>								bCancel { false };		// 请求已取消
+	TArray<FVector>									Points;					// 点位置数据
+	TArray<FVector>									Normals;				// 点法线数据
+	TArray<int32>									Triangles;				// 三角面索引
+	TArray<FVector2D>								UVs;					// UV
+	TArray<FVector>									CollisionPoints;		// 碰撞格点, 只有带碰撞的LOD生成
+	TArray<int32>									CollisionTriangles;		// 碰撞三角面索引
+	double											LODError2 = 0.0;		// LOD 2层相对LOD 1层格点的最大高度偏差, 只有带碰撞的LOD测量
+	double											LODErrorMax = 0.0;		// 最大LOD相对LOD 1层格点的最大高度偏差
+};
+typedef TSharedPtr<FDTTerrainAreaData, ESPMode::ThreadSafe> FDTTerrainAreaDataPtr;
+
+USTRUCT()
+struct FDTMeshFadeOut
+{
+	GENERATED_BODY()
+	UPROPERTY()  UMeshComponent*					Mesh;
+	int64											Interval;				// 组件的格点间隔, 用于重新放回LOD槽位
+};
 
 USTRUCT()
 struct FDTMeshLOD
@@ -17,6 +51,12 @@ struct FDTMeshLOD
 	UPROPERTY()  UMeshComponent*					MeshLOD1;
 	UPROPERTY()  UMeshComponent*					MeshLOD2;
 	UPROPERTY()  UMeshComponent*					MeshLODMax;
+	UPROPERTY()  UMeshComponent*					MeshShow;				// 当前显示的LOD
+	UPROPERTY()  TArray<FDTMeshFadeOut>				ArrayFadeOut;			// 正在淡出的LOD, 已经从LOD槽位移出, 常驻LOD除外
+	double											FadeBeginTime;			// 过渡开始时间
+	double											LODError2;				// LOD 2层的几何偏差, LOD 1层为参照
+	double											LODErrorMax;			// 最大LOD的几何偏差
+	FDTTerrainAreaDataPtr							PendingArea;			// 正在生成的LOD
 };
 
 UCLASS(ClassGroup=(Custom), meta=(BlueprintSpawnableComponent))
@@ -26,9 +66,30 @@ class DTMODEL_API UDTTerrainComponent : public USceneComponent
 
 public:
 	UPROPERTY()	UMaterial *													m_Material;
-	UPROPERTY() TMap<FInt64Vector2, double>									m_MapElevation;
 	UPROPERTY() TMap<FInt64Vector2, FDTMeshLOD>								m_MapMesh;
 	UPROPERTY() UFastNoiseWrapper *											m_FastNoiseWrapper;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite) float						m_FrameBudgetMs;					// 每帧创建和销毁组件的时间预算(毫秒)
+	UPROPERTY(EditAnywhere, BlueprintReadWrite) float						m_MaxPixelError;					// LOD允许的最大屏幕误差(像素), 小于等于 0 时使用距离分段
+	UPROPERTY(EditAnywhere, BlueprintReadWrite) bool						m_bLODFade;							// LOD抖动过渡, 材质需要按过渡值做抖动裁剪, 否则两层LOD会深度冲突
+
+private:
+	TUniquePtr<FDTElevationCache>											m_ElevationCache;					// 高程缓存
+	TArray<FDTTerrainAreaDataPtr>											m_ArrayRequest;						// 等待生成的区域
+	TArray<UE::Tasks::FTask>												m_ArrayTask;						// 正在生成的任务
+	TQueue<FDTTerrainAreaDataPtr, EQueueMode::Mpsc>							m_QueueFinish;						// 生成完成的区域
+	TArray<FDTTerrainAreaDataPtr>											m_ArrayReady;						// 等待创建组件的区域
+	UPROPERTY() TArray<UMeshComponent *>									m_ArrayRecycle;						// 等待回收的组件
+	UPROPERTY() TArray<UDTHMeshComponent *>									m_ArrayPool;						// 回收的组件, 保持注册并隐藏, 重复使用
+	int32																	m_NumTaskInFlight;					// 正在生成的数量
+	FVector																	m_CameraLocation;					// 摄像机位置
+	FVector																	m_CameraDirection;					// 摄像机方向
+	FIntVector																m_CameraCell;						// 上次更新时摄像机所在格子
+	FVector																	m_UpdateLocation;					// 上次更新时摄像机位置
+	TSet<FInt64Vector2>														m_SetDirty;							// 下一帧需要更新的地块
+	TSet<FInt64Vector2>														m_SetFade;							// 正在过渡LOD的地块
+	bool																	m_bFullUpdate;						// 下一帧更新所有地块
+	double																	m_ErrorScale;						// 几何偏差换算成切换距离的比例, 由视角, 视口宽度和最大屏幕误差计算
+	double																	m_MaxLODError;						// 所有地块最大LOD的最大几何偏差
 	
 public:
 	// 构造函数
@@ -37,15 +98,77 @@ public:
 protected:
 	// 开始播放
 	virtual void BeginPlay() override;
+	// 结束播放
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+	// 组件销毁
+	virtual void OnComponentDestroyed(bool bDestroyingHierarchy) override;
 
 public:
 	// 每帧函数
 	virtual void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
 
 	void DestroyMeshComponent(UMeshComponent *& MeshLOD);
+	// 隐藏组件并延迟到预算内回收
+	void ReleaseMeshComponent(UMeshComponent *& MeshLOD);
 	
 	void GenerateTerrain();
 	UMeshComponent* GenerateArea( int64 BeginX, int64 BeginY, int64 Length, int64 Interval );
-	void GenerateArea( int64 BeginX, int64 BeginY, int64 Length, int64 Interval, TFunction<void(const TArray<FVector> &, const TArray<FVector> &, const TArray<int32> &, const TArray<FVector2D> &)> Function );
+	void GenerateArea( int64 BeginX, int64 BeginY, int64 Length, int64 Interval, TFunction<void(TConstArrayView<FVector>, TConstArrayView<FVector>, TConstArrayView<int32>, TConstArrayView<FVector2D>)> Function );
+
+protected:
+	// 更新单个地块的LOD
+	void UpdateTile( const FInt64Vector2 & Point, FDTMeshLOD & Mesh );
+	// 地块LOD需要更新的最远距离, 超出时始终使用最大LOD
+	double GetUpdateDistance() const;
+	// 切换地块显示的LOD, 旧LOD在过渡时间内抖动淡出
+	void SwitchTileLOD( const FInt64Vector2 & Point, FDTMeshLOD & Mesh, UMeshComponent * MeshShow );
+	// 取回正在淡出的指定间隔组件, 避免重新生成仍在显示的LOD
+	static UMeshComponent* FindFadeOut( const FDTMeshLOD & Mesh, int64 Interval );
+	// 结束组件的淡出, 常驻LOD隐藏, 其他LOD回收
+	void EndFadeOut( const FDTMeshLOD & Mesh, UMeshComponent * MeshOut );
+	// 更新所有正在过渡的地块
+	void UpdateLODFades();
+	// 设置组件的过渡值
+	static void SetFadeValue( UMeshComponent * MeshComponent, float Value );
+	// 摄像机所在格子
+	static FIntVector GetCameraCell( const FVector & Location );
+	// 地块坐标转换为地块中心
+	static FInt64Vector2 GetTileKey( int64 TileX, int64 TileY );
+	// 添加范围内的地块
+	void AddTilesInRange( const FVector & Location, int64 Radius, TSet<FInt64Vector2> & SetTile ) const;
+	// 生成区域数据 (可在工作线程调用)
+	void GenerateAreaData( FDTTerrainAreaData & AreaData );
+	// 生成区域碰撞格点, 与渲染间隔无关 (可在工作线程调用)
+	void GenerateAreaCollision( FDTTerrainAreaData & AreaData );
+	// 地块边界添加裙边, 遮住和不同LOD相邻地块之间的裂缝 (可在工作线程调用)
+	void AppendAreaSkirt( FDTTerrainAreaData & AreaData ) const;
+	// 以LOD 1层格点为参照测量各LOD的几何偏差 (可在工作线程调用)
+	void MeasureAreaError( FDTTerrainAreaData & AreaData ) const;
+	// 读取并解码区域缓存, 文件无效时返回 false
+	bool LoadAreaCache( FDTTerrainAreaData & AreaData, const FString & FileCache, uint64 ParamHash ) const;
+	// 区域生成参数哈希, 参数变化后旧缓存失效
+	uint64 GetAreaHash( const FDTTerrainAreaData & AreaData ) const;
+	// 区域紧凑编码参数
+	static FDTMeshCacheTile GetAreaTile( const FDTTerrainAreaData & AreaData );
+	// 使用区域数据创建组件, 优先使用回收的组件 (游戏线程)
+	UMeshComponent* CreateMeshComponent( const FDTTerrainAreaData & AreaData, bool bHidden = false );
+	// 取出回收的组件, 没有时创建新组件
+	UDTHMeshComponent* AcquireMeshComponent();
+	// 清空组件放回池, 池满时销毁
+	void RecycleMeshComponent( UMeshComponent *& MeshLOD );
+	// 计算地块优先级
+	double GetPriority( const FInt64Vector2 & TileKey ) const;
+	// 请求异步生成区域
+	void RequestArea( const FInt64Vector2 & TileKey, FDTMeshLOD & Mesh, int64 Interval );
+	// 取消正在生成的区域
+	void CancelArea( FDTMeshLOD & Mesh );
+	// 启动等待中的请求
+	void LaunchRequests();
+	// 接收已完成的区域
+	void ReceiveFinished();
+	// 在预算内创建和销毁组件
+	void ProcessReady( double BeginTime );
+	// 等待所有任务完成
+	void WaitAllTasks();
 
 };
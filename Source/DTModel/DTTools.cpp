@@ -2,6 +2,10 @@
 
 
 #include "DTTools.h"
+#include "Async/ParallelFor.h"
+#include "DynamicMesh/DynamicMesh3.h"
+#include "MeshSimplification.h"
+#include "MeshConstraintsUtil.h"
 
 // 计算点法线
 FVector UDTTools::CalculateVertexNormal( const TArray<FVector> & ArrayPoints, const TArray<int32> & ArrayTriangles, const TMap<int, TArray<UE::Geometry::FIndex3i>> & MapIndex, int nPointIndex )
@@ -37,6 +41,359 @@ FVector UDTTools::CalculateVertexNormal( const TArray<FVector> & ArrayPoints, co
 	}
 }
 
+// 批量计算点法线, bAreaWeighted 为真时按三角面面积加权
+void UDTTools::CalculateVertexNormals( const TArray<FVector> & ArrayPoints, const TArray<int32> & ArrayTriangles, TArray<FVector> & ArrayNormals, bool bAreaWeighted )
+{
+	const int32 NumPoints = ArrayPoints.Num();
+	const int32 NumTriangles = ArrayTriangles.Num() / 3;
+	ArrayNormals.SetNumUninitialized(NumPoints);
+
+	// 三角面法线, 三角面按 C/B/A 顺序保存
+	TArray<FVector> ArrayFaceNormals;
+	ArrayFaceNormals.SetNumUninitialized(NumTriangles);
+	ParallelFor(NumTriangles, [&](int32 TriangleIndex)
+	{
+		const FVector & vPoint0 = ArrayPoints[ArrayTriangles[TriangleIndex * 3 + 0]];
+		const FVector & vPoint1 = ArrayPoints[ArrayTriangles[TriangleIndex * 3 + 1]];
+		const FVector & vPoint2 = ArrayPoints[ArrayTriangles[TriangleIndex * 3 + 2]];
+		FVector vNormal = (vPoint2 - vPoint0) ^ (vPoint1 - vPoint0);
+		if ( !bAreaWeighted )
+		{
+			vNormal.Normalize();
+		}
+		ArrayFaceNormals[TriangleIndex] = vNormal;
+	});
+
+	// 点到三角面的压缩邻接表, 顺序与三角面顺序一致
+	TArray<int32> ArrayOffsets;
+	ArrayOffsets.SetNumZeroed(NumPoints + 1);
+	for ( int32 Index = 0; Index < NumTriangles * 3; ++Index )
+	{
+		++ArrayOffsets[ArrayTriangles[Index] + 1];
+	}
+	for ( int32 Index = 0; Index < NumPoints; ++Index )
+	{
+		ArrayOffsets[Index + 1] += ArrayOffsets[Index];
+	}
+	TArray<int32> ArrayAdjacency;
+	ArrayAdjacency.SetNumUninitialized(NumTriangles * 3);
+	{
+		TArray<int32> ArrayCursor(ArrayOffsets.GetData(), NumPoints);
+		for ( int32 Index = 0; Index < NumTriangles * 3; ++Index )
+		{
+			ArrayAdjacency[ArrayCursor[ArrayTriangles[Index]]++] = Index / 3;
+		}
+	}
+
+	// 汇总相邻三角面法线
+	ParallelFor(NumPoints, [&](int32 PointIndex)
+	{
+		const int32 Begin = ArrayOffsets[PointIndex];
+		const int32 End = ArrayOffsets[PointIndex + 1];
+		FVector vNormalSum = FVector::ZeroVector;
+		for ( int32 Index = Begin; Index < End; ++Index )
+		{
+			vNormalSum += ArrayFaceNormals[ArrayAdjacency[Index]];
+		}
+
+		if ( End == Begin )
+		{
+			ArrayNormals[PointIndex] = FVector::ZAxisVector;
+		}
+		else if ( bAreaWeighted )
+		{
+			ArrayNormals[PointIndex] = vNormalSum.GetSafeNormal(UE_SMALL_NUMBER, FVector::ZAxisVector);
+		}
+		else
+		{
+			const FVector Vector(vNormalSum / static_cast<float>(End - Begin));
+			ArrayNormals[PointIndex] = Vector.Equals(FVector::ZeroVector) ? FVector::ZAxisVector : Vector;
+		}
+	});
+}
+
+// 规则网格三角化, 点索引为 X * CountY + Y, 三角面按 C/B/A 顺序输出
+void UDTTools::TriangulateGrid( int32 CountX, int32 CountY, TArray<int32> & ArrayTriangles, int32 BaseIndex )
+{
+	if ( CountX < 2 || CountY < 2 )
+	{
+		return;
+	}
+
+	ArrayTriangles.Reserve(ArrayTriangles.Num() + (CountX - 1) * (CountY - 1) * 6);
+	for ( int32 X = 0; X < CountX - 1; ++X )
+	{
+		for ( int32 Y = 0; Y < CountY - 1; ++Y )
+		{
+			const int32 Index00 = BaseIndex + X * CountY + Y;
+			const int32 Index10 = Index00 + CountY;
+			const int32 Index01 = Index00 + 1;
+			const int32 Index11 = Index10 + 1;
+
+			// 逆时针 (00, 10, 11) 和 (00, 11, 01), 反序输出
+			ArrayTriangles.Add(Index11);
+			ArrayTriangles.Add(Index10);
+			ArrayTriangles.Add(Index00);
+			ArrayTriangles.Add(Index01);
+			ArrayTriangles.Add(Index11);
+			ArrayTriangles.Add(Index00);
+		}
+	}
+}
+
+// 带加密边界的网格三角化, 内部点间隔 Interval, 边界点间隔 BorderInterval
+void UDTTools::TriangulateBorderedGrid( int64 BeginX, int64 BeginY, int64 Length, int64 Interval, int64 BorderInterval, TArray<FVector2D> & ArrayPoints, TArray<int32> & ArrayTriangles )
+{
+	const int32 CountBorder = static_cast<int32>(Length / BorderInterval);
+	const int32 CountInner = static_cast<int32>(Length / Interval);
+
+	// 间隔相同或内部没有点时, 整体按边界间隔生成规则网格
+	if ( Interval == BorderInterval || CountInner < 2 )
+	{
+		const int32 BaseIndex = ArrayPoints.Num();
+		ArrayPoints.Reserve(BaseIndex + (CountBorder + 1) * (CountBorder + 1));
+		for ( int32 X = 0; X <= CountBorder; ++X )
+		{
+			for ( int32 Y = 0; Y <= CountBorder; ++Y )
+			{
+				ArrayPoints.Add( FVector2D( BeginX + X * BorderInterval, BeginY + Y * BorderInterval ) );
+			}
+		}
+		TriangulateGrid(CountBorder + 1, CountBorder + 1, ArrayTriangles, BaseIndex);
+		return;
+	}
+
+	// 内部点, 第一圈距离边界一个间隔
+	const int32 InnerBase = ArrayPoints.Num();
+	const int32 CountInnerSide = CountInner - 1;
+	ArrayPoints.Reserve(InnerBase + CountInnerSide * CountInnerSide + CountBorder * 4);
+	for ( int32 X = 1; X <= CountInnerSide; ++X )
+	{
+		for ( int32 Y = 1; Y <= CountInnerSide; ++Y )
+		{
+			ArrayPoints.Add( FVector2D( BeginX + X * Interval, BeginY + Y * Interval ) );
+		}
+	}
+	TriangulateGrid(CountInnerSide, CountInnerSide, ArrayTriangles, InnerBase);
+
+	// 边界点, 从起点开始逆时针一圈
+	const int32 BorderBase = ArrayPoints.Num();
+	const int64 EndX = BeginX + Length;
+	const int64 EndY = BeginY + Length;
+	for ( int32 Index = 0; Index < CountBorder; ++Index ) { ArrayPoints.Add( FVector2D( BeginX + Index * BorderInterval, BeginY ) ); }
+	for ( int32 Index = 0; Index < CountBorder; ++Index ) { ArrayPoints.Add( FVector2D( EndX, BeginY + Index * BorderInterval ) ); }
+	for ( int32 Index = 0; Index < CountBorder; ++Index ) { ArrayPoints.Add( FVector2D( EndX - Index * BorderInterval, EndY ) ); }
+	for ( int32 Index = 0; Index < CountBorder; ++Index ) { ArrayPoints.Add( FVector2D( BeginX, EndY - Index * BorderInterval ) ); }
+
+	// 内部第一圈上的点索引, 方向与边界一致
+	auto GetInnerIndex = [&](int32 Side, int32 Index) -> int32
+	{
+		const int32 Along = Index + 1;
+		const int32 Reverse = CountInnerSide - Index;
+		switch ( Side )
+		{
+		case 0:  return InnerBase + (Along - 1) * CountInnerSide;
+		case 1:  return InnerBase + (CountInnerSide - 1) * CountInnerSide + (Along - 1);
+		case 2:  return InnerBase + (Reverse - 1) * CountInnerSide + (CountInnerSide - 1);
+		default: return InnerBase + (Reverse - 1);
+		}
+	};
+
+	// 每条边把边界点和内部第一圈缝合, 角点与内部角点相连
+	ArrayTriangles.Reserve(ArrayTriangles.Num() + (CountBorder + CountInnerSide) * 4 * 3);
+	for ( int32 Side = 0; Side < 4; ++Side )
+	{
+		int32 Outer = 0;
+		int32 Inner = 0;
+		while ( Outer < CountBorder || Inner < CountInnerSide - 1 )
+		{
+			const int32 OuterIndex = BorderBase + (Side * CountBorder + Outer) % (CountBorder * 4);
+			const int32 InnerIndex = GetInnerIndex(Side, Inner);
+
+			// 下一个边界点在内部两点中间之前时前进边界
+			const bool bAdvanceOuter = Inner >= CountInnerSide - 1
+				|| ( Outer < CountBorder && (Outer + 1) * BorderInterval * 2 <= (Inner * 2 + 3) * Interval );
+			if ( bAdvanceOuter )
+			{
+				const int32 OuterNext = BorderBase + (Side * CountBorder + Outer + 1) % (CountBorder * 4);
+				ArrayTriangles.Add(InnerIndex);
+				ArrayTriangles.Add(OuterNext);
+				ArrayTriangles.Add(OuterIndex);
+				++Outer;
+			}
+			else
+			{
+				const int32 InnerNext = GetInnerIndex(Side, Inner + 1);
+				ArrayTriangles.Add(InnerIndex);
+				ArrayTriangles.Add(InnerNext);
+				ArrayTriangles.Add(OuterIndex);
+				++Inner;
+			}
+		}
+	}
+}
+
+// 点到目标网格表面的最大距离
+double UDTTools::MeasureMeshDeviation( TConstArrayView<FVector3f> ArrayPoints, TConstArrayView<FVector3f> ArrayTargetPoints, TConstArrayView<FUintVector> ArrayTargetTriangles )
+{
+	if ( !ArrayPoints.Num() || !ArrayTargetTriangles.Num() )
+	{
+		return 0.0;
+	}
+
+	// 格子边长取三角面包围盒的平均边长, 格子数量限制在每轴 256 以内
+	FBox3f Bounds(ForceInit);
+	double SumExtent = 0.0;
+	for ( const FUintVector & Triangle : ArrayTargetTriangles )
+	{
+		const FBox3f TriangleBox = FBox3f(ArrayTargetPoints[Triangle.X], ArrayTargetPoints[Triangle.X]) + ArrayTargetPoints[Triangle.Y] + ArrayTargetPoints[Triangle.Z];
+		Bounds += TriangleBox;
+		SumExtent += TriangleBox.GetSize().GetMax();
+	}
+	const double CellSize = FMath::Max3(SumExtent / ArrayTargetTriangles.Num(), static_cast<double>(Bounds.GetSize().GetMax()) / 256.0, static_cast<double>(UE_KINDA_SMALL_NUMBER));
+	const FVector Origin(Bounds.Min);
+	const FIntVector CellMax( FMath::FloorToInt32(Bounds.GetSize().X / CellSize), FMath::FloorToInt32(Bounds.GetSize().Y / CellSize), FMath::FloorToInt32(Bounds.GetSize().Z / CellSize) );
+	auto ToCell = [&](const FVector & Position)
+	{
+		const FVector Local = (Position - Origin) / CellSize;
+		return FIntVector( FMath::Clamp(FMath::FloorToInt32(Local.X), 0, CellMax.X), FMath::Clamp(FMath::FloorToInt32(Local.Y), 0, CellMax.Y), FMath::Clamp(FMath::FloorToInt32(Local.Z), 0, CellMax.Z) );
+	};
+
+	// 三角面放入包围盒覆盖的所有格子
+	TMap<FIntVector, TArray<int32>> MapCell;
+	for ( int32 TriIndex = 0; TriIndex < ArrayTargetTriangles.Num(); ++TriIndex )
+	{
+		const FUintVector & Triangle = ArrayTargetTriangles[TriIndex];
+		const FBox3f TriangleBox = FBox3f(ArrayTargetPoints[Triangle.X], ArrayTargetPoints[Triangle.X]) + ArrayTargetPoints[Triangle.Y] + ArrayTargetPoints[Triangle.Z];
+		const FIntVector CellBegin = ToCell(FVector(TriangleBox.Min));
+		const FIntVector CellEnd = ToCell(FVector(TriangleBox.Max));
+		for ( int32 X = CellBegin.X; X <= CellEnd.X; ++X )
+		{
+			for ( int32 Y = CellBegin.Y; Y <= CellEnd.Y; ++Y )
+			{
+				for ( int32 Z = CellBegin.Z; Z <= CellEnd.Z; ++Z )
+				{
+					MapCell.FindOrAdd(FIntVector(X, Y, Z)).Add(TriIndex);
+				}
+			}
+		}
+	}
+
+	// 每个点从所在格子按环向外查找, 环外的三角面距离至少为 环数 * 格子边长, 已找到更近的三角面时结束
+	const int32 MaxRing = CellMax.GetMax() + 1;
+	TArray<double> ArrayDistance;
+	ArrayDistance.SetNumZeroed(ArrayPoints.Num());
+	ParallelFor(ArrayPoints.Num(), [&](int32 Index)
+	{
+		const FVector Point(ArrayPoints[Index]);
+		const FIntVector Cell = ToCell(Point);
+		double BestSquared = MAX_dbl;
+		for ( int32 Ring = 0; Ring <= MaxRing; ++Ring )
+		{
+			for ( int32 X = FMath::Max(Cell.X - Ring, 0); X <= FMath::Min(Cell.X + Ring, CellMax.X); ++X )
+			{
+				for ( int32 Y = FMath::Max(Cell.Y - Ring, 0); Y <= FMath::Min(Cell.Y + Ring, CellMax.Y); ++Y )
+				{
+					for ( int32 Z = FMath::Max(Cell.Z - Ring, 0); Z <= FMath::Min(Cell.Z + Ring, CellMax.Z); ++Z )
+					{
+						// 只查找当前环上的格子
+						if ( FMath::Max3(FMath::Abs(X - Cell.X), FMath::Abs(Y - Cell.Y), FMath::Abs(Z - Cell.Z)) != Ring )
+						{
+							continue;
+						}
+						const TArray<int32> * ArrayCellTriangle = MapCell.Find(FIntVector(X, Y, Z));
+						if ( ArrayCellTriangle == nullptr )
+						{
+							continue;
+						}
+						for ( const int32 TriIndex : *ArrayCellTriangle )
+						{
+							const FUintVector & Triangle = ArrayTargetTriangles[TriIndex];
+							const FVector Closest = FMath::ClosestPointOnTriangleToPoint(Point, FVector(ArrayTargetPoints[Triangle.X]), FVector(ArrayTargetPoints[Triangle.Y]), FVector(ArrayTargetPoints[Triangle.Z]));
+							BestSquared = FMath::Min(BestSquared, FVector::DistSquared(Point, Closest));
+						}
+					}
+				}
+			}
+			if ( BestSquared <= FMath::Square(Ring * CellSize) )
+			{
+				break;
+			}
+		}
+		ArrayDistance[Index] = FMath::Sqrt(BestSquared);
+	});
+
+	double MaxDistance = 0.0;
+	for ( const double Distance : ArrayDistance )
+	{
+		MaxDistance = FMath::Max(MaxDistance, Distance);
+	}
+	return MaxDistance;
+}
+
+// 二次误差简化网格
+void UDTTools::SimplifyMesh( TConstArrayView<FVector> ArrayPoints, TConstArrayView<int32> ArrayTriangles, TConstArrayView<FVector> ArrayNormals, TConstArrayView<FVector2D> ArrayUVs, int32 TargetTriangleCount, bool bPreserveBorders,
+							TArray<FVector> & OutPoints, TArray<int32> & OutTriangles, TArray<FVector> & OutNormals, TArray<FVector2D> & OutUVs )
+{
+	using namespace UE::Geometry;
+
+	// 法线和UV作为点属性, 折叠时随点保留
+	const bool HaveNormal = ArrayNormals.Num() == ArrayPoints.Num();
+	const bool HaveUV = ArrayUVs.Num() == ArrayPoints.Num();
+	FDynamicMesh3 Mesh(HaveNormal, false, HaveUV, false);
+	for ( int32 Index = 0; Index < ArrayPoints.Num(); ++Index )
+	{
+		FVertexInfo VertexInfo(ArrayPoints[Index]);
+		VertexInfo.bHaveN = HaveNormal;
+		VertexInfo.Normal = HaveNormal ? FVector3f(ArrayNormals[Index]) : FVector3f::ZeroVector;
+		VertexInfo.bHaveUV = HaveUV;
+		VertexInfo.UV = HaveUV ? FVector2f(ArrayUVs[Index]) : FVector2f::ZeroVector;
+		Mesh.AppendVertex(VertexInfo);
+	}
+
+	// 非流形三角面无法加入, 直接跳过
+	for ( int32 Index = 0; Index + 2 < ArrayTriangles.Num(); Index += 3 )
+	{
+		Mesh.AppendTriangle(ArrayTriangles[Index], ArrayTriangles[Index + 1], ArrayTriangles[Index + 2]);
+	}
+
+	// 开放边界固定, UV接缝处的重复点也是边界, 一起保持不变
+	FQEMSimplification Simplifier(&Mesh);
+	if ( bPreserveBorders )
+	{
+		FMeshConstraints Constraints;
+		FMeshConstraintsUtil::ConstrainAllBoundariesAndSeams(Constraints, Mesh, EEdgeRefineFlags::FullyConstrained, EEdgeRefineFlags::NoConstraint, EEdgeRefineFlags::NoConstraint, false, false, false);
+		Simplifier.SetExternalConstraints(MoveTemp(Constraints));
+	}
+	Simplifier.SimplifyToTriangleCount(FMath::Max(TargetTriangleCount, 1));
+
+	// 压缩后点和三角面索引连续
+	Mesh.CompactInPlace();
+	OutPoints.SetNumUninitialized(Mesh.VertexCount());
+	OutNormals.SetNumUninitialized(HaveNormal ? Mesh.VertexCount() : 0);
+	OutUVs.SetNumUninitialized(HaveUV ? Mesh.VertexCount() : 0);
+	for ( int32 VertexID = 0; VertexID < Mesh.VertexCount(); ++VertexID )
+	{
+		OutPoints[VertexID] = Mesh.GetVertex(VertexID);
+		if ( HaveNormal )
+		{
+			OutNormals[VertexID] = FVector(Mesh.GetVertexNormal(VertexID));
+		}
+		if ( HaveUV )
+		{
+			OutUVs[VertexID] = FVector2D(Mesh.GetVertexUV(VertexID));
+		}
+	}
+	OutTriangles.SetNumUninitialized(Mesh.TriangleCount() * 3);
+	for ( int32 TriangleID = 0; TriangleID < Mesh.TriangleCount(); ++TriangleID )
+	{
+		const FIndex3i Triangle = Mesh.GetTriangle(TriangleID);
+		OutTriangles[TriangleID * 3] = Triangle.A;
+		OutTriangles[TriangleID * 3 + 1] = Triangle.B;
+		OutTriangles[TriangleID * 3 + 2] = Triangle.C;
+	}
+}
+
 // 组件添加碰撞通道
 void UDTTools::ComponentAddsCollisionChannel(UPrimitiveComponent* Component)
 {
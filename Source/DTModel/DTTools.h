@@ -18,6 +18,17 @@ class DTMODEL_API UDTTools : public UBlueprintFunctionLibrary
 public:
 	// 计算点法线
 	static FVector CalculateVertexNormal( const TArray<FVector> & ArrayPoints, const TArray<int32> & ArrayTriangles, const TMap<int, TArray<UE::Geometry::FIndex3i>> & MapIndex, int nPointIndex );
+	// 批量计算点法线, bAreaWeighted 为真时按三角面面积加权
+	static void CalculateVertexNormals( const TArray<FVector> & ArrayPoints, const TArray<int32> & ArrayTriangles, TArray<FVector> & ArrayNormals, bool bAreaWeighted = false );
+	// 规则网格三角化, 点索引为 X * CountY + Y, 三角面按 C/B/A 顺序输出
+	static void TriangulateGrid( int32 CountX, int32 CountY, TArray<int32> & ArrayTriangles, int32 BaseIndex = 0 );
+	// 带加密边界的网格三角化, 内部点间隔 Interval, 边界点间隔 BorderInterval
+	static void TriangulateBorderedGrid( int64 BeginX, int64 BeginY, int64 Length, int64 Interval, int64 BorderInterval, TArray<FVector2D> & ArrayPoints, TArray<int32> & ArrayTriangles );
+	// 点到目标网格表面的最大距离 (单向 Hausdorff 距离), 用于测量简化网格相对原网格的几何偏差
+	static double MeasureMeshDeviation( TConstArrayView<FVector3f> ArrayPoints, TConstArrayView<FVector3f> ArrayTargetPoints, TConstArrayView<FUintVector> ArrayTargetTriangles );
+	// 二次误差简化网格到目标三角面数量, bPreserveBorders 为真时边界点和边界边保持不变, 相邻网格拼接无缝
+	static void SimplifyMesh( TConstArrayView<FVector> ArrayPoints, TConstArrayView<int32> ArrayTriangles, TConstArrayView<FVector> ArrayNormals, TConstArrayView<FVector2D> ArrayUVs, int32 TargetTriangleCount, bool bPreserveBorders,
+							TArray<FVector> & OutPoints, TArray<int32> & OutTriangles, TArray<FVector> & OutNormals, TArray<FVector2D> & OutUVs );
 	// 组件添加碰撞通道
 	static void ComponentAddsCollisionChannel( UPrimitiveComponent * Component );
 };
@@ -0,0 +1,337 @@
+﻿// Copyright 2023-2024 Dexter.Wan. All Rights Reserved.
+// EMail: 45141961@qq.com
+// Website: https://dt.cq.cn
+
+#include "DTMeshCache.h"
+#include "DTModel/DTTools.h"
+#include "Async/MappedFileHandle.h"
+#include "HAL/FileManager.h"
+#include "HAL/PlatformFileManager.h"
+#include "Misc/Crc.h"
+#include "Misc/FileHelper.h"
+
+static constexpr uint32 DTMeshCacheMagic = 0x434D5444;							// "DTMC"
+static uint8 DTMeshCachePadding[DTMeshCacheAlignment] = {};						// 对齐填充
+
+// 计算校验, 分段计算以支持超过 2GB 的数据
+static uint32 MemCrc(const uint8 * Data, uint64 Size, uint32 Crc = 0)
+{
+	while ( Size > 0 )
+	{
+		const int32 Length = static_cast<int32>(FMath::Min<uint64>(Size, MAX_int32));
+		Crc = FCrc::MemCrc32(Data, Length, Crc);
+		Data += Length;
+		Size -= Length;
+	}
+	return Crc;
+}
+
+// 文件头和段表校验, 校验字段本身按 0 计算
+static uint32 TableCrc(const FDTMeshCacheHeader & Header, const FDTMeshCacheSection * Sections, uint32 SectionCount)
+{
+	FDTMeshCacheHeader HeaderCopy = Header;
+	HeaderCopy.TableCrc = 0;
+	const uint32 Crc = MemCrc(reinterpret_cast<const uint8 *>(&HeaderCopy), sizeof(HeaderCopy));
+	return MemCrc(reinterpret_cast<const uint8 *>(Sections), static_cast<uint64>(SectionCount) * sizeof(FDTMeshCacheSection), Crc);
+}
+
+// 添加紧凑地形块
+bool FDTMeshCacheWriter::AddTile(const FDTMeshCacheTile& Tile, TConstArrayView<FVector> Points, TConstArrayView<FVector> Normals)
+{
+	if ( Points.Num() == 0 || Points.Num() != Normals.Num() )
+	{
+		return false;
+	}
+
+	// 高度范围, 按量化步长取整
+	int64 HeightMin = MAX_int64;
+	int64 HeightMax = MIN_int64;
+	for ( const FVector & Point : Points )
+	{
+		const int64 Height = FMath::RoundToInt64(Point.Z / Tile.HeightQuantum);
+		HeightMin = FMath::Min(HeightMin, Height);
+		HeightMax = FMath::Max(HeightMax, Height);
+	}
+	const uint32 HeightBits = HeightMax - HeightMin <= MAX_uint16 ? 16 : ( HeightMax - HeightMin <= 0xFFFFFF ? 24 : 0 );
+	if ( HeightBits == 0 )
+	{
+		return false;
+	}
+
+	// 地块参数
+	TArray<uint8> & TileData = m_ArrayEncoded.AddDefaulted_GetRef();
+	TileData.SetNumUninitialized(sizeof(FDTMeshCacheTile));
+	FDTMeshCacheTile & TileInfo = *reinterpret_cast<FDTMeshCacheTile *>(TileData.GetData());
+	TileInfo = Tile;
+	TileInfo.HeightMin = HeightMin;
+	TileInfo.HeightBits = HeightBits;
+	TileInfo.Reserved = 0;
+	m_ArrayStream.Add( { EDTMeshCacheStream::Tile, static_cast<uint32>(sizeof(FDTMeshCacheTile)), 1, TileData.GetData() } );
+
+	// 量化高度, 小端保存
+	const int32 HeightBytes = HeightBits / 8;
+	TArray<uint8> & HeightData = m_ArrayEncoded.AddDefaulted_GetRef();
+	HeightData.SetNumUninitialized(Points.Num() * HeightBytes);
+	for ( int32 Index = 0; Index < Points.Num(); ++Index )
+	{
+		const uint32 Height = static_cast<uint32>(FMath::RoundToInt64(Points[Index].Z / Tile.HeightQuantum) - HeightMin);
+		for ( int32 Byte = 0; Byte < HeightBytes; ++Byte )
+		{
+			HeightData[Index * HeightBytes + Byte] = static_cast<uint8>(Height >> (Byte * 8));
+		}
+	}
+	m_ArrayStream.Add( { EDTMeshCacheStream::Heights, 1, static_cast<uint64>(HeightData.Num()), HeightData.GetData() } );
+
+	// 压缩法线
+	TArray<uint8> & NormalData = m_ArrayEncoded.AddDefaulted_GetRef();
+	NormalData.SetNumUninitialized(Normals.Num() * sizeof(uint32));
+	uint32 * PackedNormals = reinterpret_cast<uint32 *>(NormalData.GetData());
+	for ( int32 Index = 0; Index < Normals.Num(); ++Index )
+	{
+		PackedNormals[Index] = FDTMeshCache::EncodeOctNormal(Normals[Index]);
+	}
+	m_ArrayStream.Add( { EDTMeshCacheStream::OctNormals, static_cast<uint32>(sizeof(uint32)), static_cast<uint64>(Normals.Num()), NormalData.GetData() } );
+	return true;
+}
+
+// 保存文件
+bool FDTMeshCacheWriter::Save(const FString& Filename, uint64 ParamHash) const
+{
+	// 段表, 数据流从段表之后按对齐依次排列
+	TArray<FDTMeshCacheSection> ArraySection;
+	uint64 Offset = Align<uint64>(sizeof(FDTMeshCacheHeader) + m_ArrayStream.Num() * sizeof(FDTMeshCacheSection), DTMeshCacheAlignment);
+	for ( const FStream & Stream : m_ArrayStream )
+	{
+		const uint64 Size = Stream.Count * Stream.Stride;
+		FDTMeshCacheSection & Section = ArraySection.AddZeroed_GetRef();
+		Section.Type = static_cast<uint32>(Stream.Type);
+		Section.Stride = Stream.Stride;
+		Section.Count = Stream.Count;
+		Section.Offset = Offset;
+		Section.Crc = MemCrc(Stream.Data, Size);
+		Offset = Align<uint64>(Offset + Size, DTMeshCacheAlignment);
+	}
+
+	FDTMeshCacheHeader Header;
+	FMemory::Memzero(Header);
+	Header.Magic = DTMeshCacheMagic;
+	Header.Version = DTMeshCacheVersion;
+	Header.ParamHash = ParamHash;
+	Header.FileSize = Offset;
+	Header.StreamCount = ArraySection.Num();
+	Header.TableCrc = TableCrc(Header, ArraySection.GetData(), ArraySection.Num());
+
+	// 写入临时文件
+	const FString TempFilename = FString::Printf(TEXT("%s.%s.tmp"), *Filename, *FGuid::NewGuid().ToString());
+	TUniquePtr<FArchive> Writer(IFileManager::Get().CreateFileWriter(*TempFilename));
+	if ( !Writer.IsValid() )
+	{
+		return false;
+	}
+	Writer->Serialize(&Header, sizeof(Header));
+	Writer->Serialize(ArraySection.GetData(), ArraySection.Num() * sizeof(FDTMeshCacheSection));
+	for ( int32 Index = 0; Index < m_ArrayStream.Num(); ++Index )
+	{
+		Writer->Serialize(DTMeshCachePadding, static_cast<int64>(ArraySection[Index].Offset) - Writer->Tell());
+		Writer->Serialize(const_cast<uint8 *>(m_ArrayStream[Index].Data), m_ArrayStream[Index].Count * m_ArrayStream[Index].Stride);
+	}
+	Writer->Serialize(DTMeshCachePadding, static_cast<int64>(Header.FileSize) - Writer->Tell());
+	const bool bSuccess = Writer->Close() && !Writer->IsError();
+	Writer.Reset();
+
+	// 替换正式文件
+	if ( !bSuccess || !IFileManager::Get().Move(*Filename, *TempFilename, true, true) )
+	{
+		IFileManager::Get().Delete(*TempFilename, false, true, true);
+		return false;
+	}
+	return true;
+}
+
+// 构造函数
+FDTMeshCache::FDTMeshCache()
+	: m_Data(nullptr)
+{
+}
+
+// 析构函数, 先释放映射区域再关闭文件
+FDTMeshCache::~FDTMeshCache()
+{
+	m_MappedRegion.Reset();
+	m_MappedHandle.Reset();
+}
+
+// 读取缓存
+FDTMeshCachePtr FDTMeshCache::Load(const FString& Filename, uint64 ParamHash)
+{
+	FDTMeshCachePtr MeshCache = MakeShared<FDTMeshCache, ESPMode::ThreadSafe>();
+	if ( !MeshCache->Open(Filename, ParamHash) )
+	{
+		return nullptr;
+	}
+	return MeshCache;
+}
+
+// 打开并校验文件
+bool FDTMeshCache::Open(const FString& Filename, uint64 ParamHash)
+{
+	IPlatformFile & PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	int64 FileSize = PlatformFile.FileSize(*Filename);
+	if ( FileSize < static_cast<int64>(sizeof(FDTMeshCacheHeader)) )
+	{
+		return false;
+	}
+
+	// 映射整个文件, 不支持映射的平台读取到内存
+	m_MappedHandle.Reset(PlatformFile.OpenMapped(*Filename));
+	if ( m_MappedHandle.IsValid() )
+	{
+		m_MappedRegion.Reset(m_MappedHandle->MapRegion(0, FileSize));
+	}
+	if ( m_MappedRegion.IsValid() )
+	{
+		m_Data = m_MappedRegion->GetMappedPtr();
+		FileSize = m_MappedRegion->GetMappedSize();
+	}
+	else
+	{
+		m_MappedHandle.Reset();
+		if ( !FFileHelper::LoadFileToArray(m_FallbackData, *Filename, FILEREAD_Silent) )
+		{
+			return false;
+		}
+		m_Data = m_FallbackData.GetData();
+		FileSize = m_FallbackData.Num();
+	}
+
+	// 校验文件头
+	if ( FileSize < static_cast<int64>(sizeof(FDTMeshCacheHeader)) )
+	{
+		return false;
+	}
+	const FDTMeshCacheHeader & Header = *reinterpret_cast<const FDTMeshCacheHeader *>(m_Data);
+	if ( Header.Magic != DTMeshCacheMagic || Header.Version != DTMeshCacheVersion || Header.ParamHash != ParamHash || Header.FileSize != static_cast<uint64>(FileSize) )
+	{
+		return false;
+	}
+	const uint64 TableEnd = sizeof(FDTMeshCacheHeader) + static_cast<uint64>(Header.StreamCount) * sizeof(FDTMeshCacheSection);
+	if ( TableEnd > Header.FileSize )
+	{
+		return false;
+	}
+	const FDTMeshCacheSection * Sections = reinterpret_cast<const FDTMeshCacheSection *>(m_Data + sizeof(FDTMeshCacheHeader));
+	if ( Header.TableCrc != TableCrc(Header, Sections, Header.StreamCount) )
+	{
+		return false;
+	}
+
+	// 校验数据流
+	for ( uint32 Index = 0; Index < Header.StreamCount; ++Index )
+	{
+		const FDTMeshCacheSection & Section = Sections[Index];
+		if ( Section.Stride == 0 || Section.Offset < TableEnd || Section.Offset % DTMeshCacheAlignment != 0
+			|| Section.Offset > Header.FileSize || Section.Count > (Header.FileSize - Section.Offset) / Section.Stride )
+		{
+			return false;
+		}
+		if ( Section.Crc != MemCrc(m_Data + Section.Offset, Section.Count * Section.Stride) )
+		{
+			return false;
+		}
+		m_ArraySection.Add(Section);
+	}
+	return true;
+}
+
+// 解码紧凑地形块
+bool FDTMeshCache::DecodeTile(TArray<FVector>& OutPoints, TArray<FVector>& OutNormals, TArray<int32>& OutTriangles, TArray<FVector2D>& OutUVs) const
+{
+	const TConstArrayView<FDTMeshCacheTile> ViewTile = GetStream<FDTMeshCacheTile>(EDTMeshCacheStream::Tile);
+	const TConstArrayView<uint8> ViewHeights = GetStream<uint8>(EDTMeshCacheStream::Heights);
+	const TConstArrayView<uint32> ViewNormals = GetStream<uint32>(EDTMeshCacheStream::OctNormals);
+	if ( ViewTile.Num() != 1 || ( ViewTile[0].HeightBits != 16 && ViewTile[0].HeightBits != 24 ) )
+	{
+		return false;
+	}
+	const FDTMeshCacheTile & Tile = ViewTile[0];
+	if ( Tile.Length <= 0 || Tile.Interval <= 0 || Tile.BorderInterval <= 0 || Tile.HeightQuantum <= 0.0 )
+	{
+		return false;
+	}
+
+	// 重新生成网格点和三角面
+	TArray<FVector2D> ArrayVector2D;
+	OutTriangles.Reset();
+	UDTTools::TriangulateBorderedGrid(Tile.BeginX, Tile.BeginY, Tile.Length, Tile.Interval, Tile.BorderInterval, ArrayVector2D, OutTriangles);
+	const int32 NumPoints = ArrayVector2D.Num();
+	const int32 HeightBytes = Tile.HeightBits / 8;
+	if ( NumPoints == 0 || ViewHeights.Num() != NumPoints * HeightBytes || ViewNormals.Num() != NumPoints )
+	{
+		return false;
+	}
+
+	// 还原位置, 法线和UV
+	OutPoints.SetNumUninitialized(NumPoints);
+	OutNormals.SetNumUninitialized(NumPoints);
+	OutUVs.SetNumUninitialized(NumPoints);
+	for ( int32 Index = 0; Index < NumPoints; ++Index )
+	{
+		uint32 Height = 0;
+		for ( int32 Byte = 0; Byte < HeightBytes; ++Byte )
+		{
+			Height |= static_cast<uint32>(ViewHeights[Index * HeightBytes + Byte]) << (Byte * 8);
+		}
+
+		const FVector2D & Vector2D = ArrayVector2D[Index];
+		OutPoints[Index] = FVector(Vector2D.X, Vector2D.Y, static_cast<double>(Tile.HeightMin + Height) * Tile.HeightQuantum);
+		OutNormals[Index] = DecodeOctNormal(ViewNormals[Index]);
+		OutUVs[Index] = FVector2D((Vector2D.X - Tile.UVOriginX) / Tile.UVSizeX, (Vector2D.Y - Tile.UVOriginY) / Tile.UVSizeY);
+	}
+	return true;
+}
+
+// 八面体压缩法线
+uint32 FDTMeshCache::EncodeOctNormal(const FVector& Normal)
+{
+	const double Sum = FMath::Abs(Normal.X) + FMath::Abs(Normal.Y) + FMath::Abs(Normal.Z);
+	if ( Sum <= UE_SMALL_NUMBER )
+	{
+		return 0;
+	}
+
+	// 投影到八面体, 下半球折叠到外侧
+	double X = Normal.X / Sum;
+	double Y = Normal.Y / Sum;
+	if ( Normal.Z < 0.0 )
+	{
+		const double FoldX = (1.0 - FMath::Abs(Y)) * (X >= 0.0 ? 1.0 : -1.0);
+		const double FoldY = (1.0 - FMath::Abs(X)) * (Y >= 0.0 ? 1.0 : -1.0);
+		X = FoldX;
+		Y = FoldY;
+	}
+	const int16 PackedX = static_cast<int16>(FMath::RoundToInt(FMath::Clamp(X, -1.0, 1.0) * MAX_int16));
+	const int16 PackedY = static_cast<int16>(FMath::RoundToInt(FMath::Clamp(Y, -1.0, 1.0) * MAX_int16));
+	return static_cast<uint32>(static_cast<uint16>(PackedX)) | (static_cast<uint32>(static_cast<uint16>(PackedY)) << 16);
+}
+
+// 八面体解压法线
+FVector FDTMeshCache::DecodeOctNormal(uint32 Packed)
+{
+	double X = static_cast<int16>(Packed & 0xFFFF) / static_cast<double>(MAX_int16);
+	double Y = static_cast<int16>(Packed >> 16) / static_cast<double>(MAX_int16);
+	const double Z = 1.0 - FMath::Abs(X) - FMath::Abs(Y);
+	if ( Z < 0.0 )
+	{
+		const double UnfoldX = (1.0 - FMath::Abs(Y)) * (X >= 0.0 ? 1.0 : -1.0);
+		const double UnfoldY = (1.0 - FMath::Abs(X)) * (Y >= 0.0 ? 1.0 : -1.0);
+		X = UnfoldX;
+		Y = UnfoldY;
+	}
+	return FVector(X, Y, Z).GetSafeNormal(UE_SMALL_NUMBER, FVector::ZAxisVector);
+}
+
+// 查找数据流
+const FDTMeshCacheSection* FDTMeshCache::FindSection(EDTMeshCacheStream Type) const
+{
+	return m_ArraySection.FindByPredicate([Type](const FDTMeshCacheSection & Section) { return Section.Type == static_cast<uint32>(Type); });
+}
@@ -0,0 +1,162 @@
+﻿// Copyright 2023-2024 Dexter.Wan. All Rights Reserved.
+// EMail: 45141961@qq.com
+// Website: https://dt.cq.cn
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Hash/CityHash.h"
+
+class IMappedFileHandle;
+class IMappedFileRegion;
+
+// 模型缓存版本, 文件格式变化时增加
+static constexpr uint32 DTMeshCacheVersion = 2;
+// 数据流对齐
+static constexpr uint64 DTMeshCacheAlignment = 16;
+
+// 模型缓存数据流类型
+enum class EDTMeshCacheStream : uint32
+{
+	Points			= 0,					// FVector
+	Normals			= 1,					// FVector
+	Triangles		= 2,					// int32
+	UVs				= 3,					// FVector2D
+	Tile			= 4,					// FDTMeshCacheTile, 紧凑地形块参数
+	Heights			= 5,					// uint8, 每个点 HeightBits / 8 字节, 相对最低高度的量化高度
+	OctNormals		= 6,					// uint32, 八面体压缩法线, 低 16 位 X, 高 16 位 Y
+};
+
+// 紧凑地形块参数, XY 和三角面由规则网格重新生成, UV 由位置计算
+struct FDTMeshCacheTile
+{
+	int64											BeginX;					// 起点 X
+	int64											BeginY;					// 起点 Y
+	int64											Length;					// 边长
+	int64											Interval;				// 内部间隔
+	int64											BorderInterval;			// 边界间隔
+	double											HeightQuantum;			// 高度量化步长
+	int64											HeightMin;				// 最低高度, 量化单位
+	uint32											HeightBits;				// 量化位数, 16 或 24
+	uint32											Reserved;				// 保留
+	double											UVOriginX;				// UV 原点 X
+	double											UVOriginY;				// UV 原点 Y
+	double											UVSizeX;				// UV 范围 X
+	double											UVSizeY;				// UV 范围 Y
+
+	// 高度对齐到量化步长, 所有地块使用同一个步长时共享点的高度完全一致
+	static double SnapHeight(double Height, double Quantum) { return FMath::RoundToDouble(Height / Quantum) * Quantum; }
+};
+
+// 模型缓存文件头
+struct FDTMeshCacheHeader
+{
+	uint32											Magic;					// 文件标识
+	uint32											Version;				// 文件版本
+	uint64											ParamHash;				// 生成参数哈希
+	uint64											FileSize;				// 文件大小
+	uint32											StreamCount;			// 数据流数量
+	uint32											TableCrc;				// 文件头和段表校验
+};
+
+// 模型缓存段表
+struct FDTMeshCacheSection
+{
+	uint32											Type;					// 数据流类型
+	uint32											Stride;					// 元素大小
+	uint64											Count;					// 元素数量
+	uint64											Offset;					// 文件偏移, 按 DTMeshCacheAlignment 对齐
+	uint32											Crc;					// 数据校验
+	uint32											Reserved;				// 保留
+};
+
+// 生成参数哈希, 参数按顺序累加
+class FDTMeshCacheHash
+{
+private:
+	uint64											m_Hash = 0x35DE6282C9978400ull;
+
+public:
+	template<typename T>
+	FDTMeshCacheHash & operator<<(const T & Value)
+	{
+		static_assert(TIsArithmetic<T>::Value || TIsEnum<T>::Value, "Only arithmetic and enum values can be hashed");
+		m_Hash = CityHash64WithSeed(reinterpret_cast<const char *>(&Value), sizeof(T), m_Hash);
+		return *this;
+	}
+	uint64 Get() const { return m_Hash; }
+};
+
+// 模型缓存写入, 所有数据流写入同一个文件
+class FDTMeshCacheWriter
+{
+private:
+	struct FStream
+	{
+		EDTMeshCacheStream							Type;
+		uint32										Stride;
+		uint64										Count;
+		const uint8 *								Data;
+	};
+	TArray<FStream>									m_ArrayStream;			// 等待写入的数据流
+	TArray<TArray<uint8>>							m_ArrayEncoded;			// 编码后的数据, 由写入对象持有
+
+public:
+	// 添加数据流, 数据在 Save 之前必须保持有效
+	template<typename T>
+	void AddStream(EDTMeshCacheStream Type, TConstArrayView<T> Data)
+	{
+		m_ArrayStream.Add( { Type, static_cast<uint32>(sizeof(T)), static_cast<uint64>(Data.Num()), reinterpret_cast<const uint8 *>(Data.GetData()) } );
+	}
+	// 添加紧凑地形块, 点必须按 TriangulateBorderedGrid 的顺序排列, 高度超出量化范围时返回 false
+	bool AddTile(const FDTMeshCacheTile & Tile, TConstArrayView<FVector> Points, TConstArrayView<FVector> Normals);
+	// 保存文件, 先写临时文件再替换, 其他线程不会读到写了一半的文件
+	bool Save(const FString & Filename, uint64 ParamHash) const;
+};
+
+// 模型缓存读取, 文件映射到内存, 数据流直接指向映射区域
+class FDTMeshCache
+{
+private:
+	TUniquePtr<IMappedFileHandle>					m_MappedHandle;			// 映射文件
+	TUniquePtr<IMappedFileRegion>					m_MappedRegion;			// 映射区域
+	TArray64<uint8>									m_FallbackData;			// 不支持映射时读取的数据
+	const uint8 *									m_Data;					// 文件数据
+	TArray<FDTMeshCacheSection>						m_ArraySection;			// 段表
+
+public:
+	// 构造函数
+	FDTMeshCache();
+	// 析构函数
+	~FDTMeshCache();
+
+	// 读取缓存, 版本, 参数哈希或校验不一致时返回空
+	static TSharedPtr<FDTMeshCache, ESPMode::ThreadSafe> Load(const FString & Filename, uint64 ParamHash);
+
+	// 获取数据流, 类型或元素大小不一致时返回空
+	template<typename T>
+	TConstArrayView<T> GetStream(EDTMeshCacheStream Type) const
+	{
+		const FDTMeshCacheSection * Section = FindSection(Type);
+		if ( Section == nullptr || Section->Stride != sizeof(T) || Section->Count > static_cast<uint64>(MAX_int32) )
+		{
+			return TConstArrayView<T>();
+		}
+		return TConstArrayView<T>(reinterpret_cast<const T *>(m_Data + Section->Offset), static_cast<int32>(Section->Count));
+	}
+
+	// 解码紧凑地形块
+	bool DecodeTile(TArray<FVector> & OutPoints, TArray<FVector> & OutNormals, TArray<int32> & OutTriangles, TArray<FVector2D> & OutUVs) const;
+
+	// 八面体压缩法线
+	static uint32 EncodeOctNormal(const FVector & Normal);
+	// 八面体解压法线
+	static FVector DecodeOctNormal(uint32 Packed);
+
+private:
+	// 打开并校验文件
+	bool Open(const FString & Filename, uint64 ParamHash);
+	// 查找数据流
+	const FDTMeshCacheSection * FindSection(EDTMeshCacheStream Type) const;
+};
+typedef TSharedPtr<FDTMeshCache, ESPMode::ThreadSafe> FDTMeshCachePtr;